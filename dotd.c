@@ -18,6 +18,10 @@
 
 #include <SDL.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifndef M_PI
 #define M_PI (3.141592653589793)
 #endif
@@ -26,6 +30,11 @@
 #define SCREEN_WIDTH (384)
 #define SCREEN_HEIGHT (216)
 
+// simulation rate; game logic always steps by SIM_DT no matter the display
+#define SIM_HZ (60)
+#define SIM_DT (1.0f / (float)SIM_HZ)
+#define SIM_MAX_STEPS_PER_FRAME (SIM_HZ / 4)
+
 // your random number god
 struct rng {
 	uint32_t z;
@@ -64,6 +73,86 @@ static inline void rng_seed(struct rng* rng, uint32_t seed)
 	rng->w = 7653234 + seed * 69069;
 }
 
+// counter based: the same (key, counter) always gives the same number, so
+// nothing depends on the order things are drawn in (splitmix64's mixer)
+static inline uint32_t rng_hash(uint32_t key, uint32_t counter)
+{
+	uint64_t z = (((uint64_t)key << 32) | counter) + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+#define HASH_INIT (0xcbf29ce484222325ull)
+
+// FNV-1a, for telling game states apart
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t n)
+{
+	const uint8_t* p = data;
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+// game state flattened into plain bytes: no pointers, just values and the
+// live part of each pool, read back in the order it was written
+struct snapshot {
+	uint8_t* data;
+	size_t size;
+	size_t max_size;
+	size_t cursor; // reading
+};
+
+static void snapshot_put(struct snapshot* s, const void* p, size_t n)
+{
+	if (s->size + n > s->max_size) {
+		while (s->size + n > s->max_size) s->max_size = s->max_size ? s->max_size << 1 : (1 << 16);
+		s->data = realloc(s->data, s->max_size);
+		AN(s->data);
+	}
+	memcpy(s->data + s->size, p, n);
+	s->size += n;
+}
+
+static void snapshot_get(struct snapshot* s, void* p, size_t n)
+{
+	ASSERT(s->cursor + n <= s->size);
+	memcpy(p, s->data + s->cursor, n);
+	s->cursor += n;
+}
+
+#define SNAPSHOT_PUT(s, v) snapshot_put(s, &(v), sizeof(v))
+#define SNAPSHOT_GET(s, v) snapshot_get(s, &(v), sizeof(v))
+
+// out[i] = offset + scale * rng_float(rng) for n draws; the generator is
+// serial, but the float conversion and scaling run four at a time
+static void rng_fill_floats(struct rng* rng, float* out, int n, float offset, float scale)
+{
+	struct rng r = *rng;
+	int i = 0;
+	#ifdef __SSE2__
+	__m128i mantissa4 = _mm_set1_epi32(0x007fffff);
+	__m128i exponent4 = _mm_set1_epi32(127 << 23);
+	__m128 one4 = _mm_set1_ps(1.0f);
+	__m128 offset4 = _mm_set1_ps(offset);
+	__m128 scale4 = _mm_set1_ps(scale);
+	for (; i + 4 <= n; i += 4) {
+		uint32_t u0 = rng_uint32(&r);
+		uint32_t u1 = rng_uint32(&r);
+		uint32_t u2 = rng_uint32(&r);
+		uint32_t u3 = rng_uint32(&r);
+		__m128i r4 = _mm_set_epi32(u3, u2, u1, u0);
+		__m128 f4 = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(r4, mantissa4), exponent4));
+		f4 = _mm_sub_ps(f4, one4);
+		_mm_storeu_ps(out + i, _mm_add_ps(offset4, _mm_mul_ps(scale4, f4)));
+	}
+	#endif
+	for (; i < n; i++) out[i] = offset + scale * rng_float(&r);
+	*rng = r;
+}
+
 
 
 
@@ -164,12 +253,116 @@ static void drum_samples_init(struct drum_samples* ds)
 #define DRUM_ID_OPEN (3)
 #define DRUM_ID_MAX (4)
 
+static const char* drum_names[DRUM_ID_MAX] = {
+	"kick",
+	"snare",
+	"hihat",
+	"open"
+};
+
 #define DRUM_CONTROL_KICK (1<<(DRUM_ID_KICK))
 #define DRUM_CONTROL_SNARE (1<<(DRUM_ID_SNARE))
 #define DRUM_CONTROL_HIHAT (1<<(DRUM_ID_HIHAT))
 #define DRUM_CONTROL_OPEN (1<<(DRUM_ID_OPEN))
 #define DRUM_CONTROL_HEAD (1<<16)
 
+// timeline recorder, written out as chrome trace_event json (load it in
+// chrome://tracing or ui.perfetto.dev). every thread records into a
+// buffer of its own, so recording is a counter read and a store, no locks
+#define TRACE_MAX_BUFFERS (16)
+
+struct trace_event {
+	uint64_t ticks;
+	const char* name;
+	char phase; // 'B'egin, 'E'nd, 'i'nstant
+};
+
+struct trace_buffer {
+	const char* thread_name;
+	struct trace_event* events;
+	int n_events;
+	int max_events;
+	// only grown by threads that may allocate (main); others drop
+	int growable;
+	int n_dropped;
+};
+
+struct tracer {
+	uint64_t t0;
+	int n_buffers;
+	struct trace_buffer buffers[TRACE_MAX_BUFFERS];
+};
+
+static void tracer_init(struct tracer* tracer)
+{
+	memset(tracer, 0, sizeof(*tracer));
+	tracer->t0 = SDL_GetPerformanceCounter();
+}
+
+static struct trace_buffer* tracer_add_buffer(struct tracer* tracer, const char* thread_name, int max_events, int growable)
+{
+	ASSERT(tracer->n_buffers < TRACE_MAX_BUFFERS);
+	struct trace_buffer* buf = &tracer->buffers[tracer->n_buffers++];
+	buf->thread_name = thread_name;
+	buf->max_events = max_events;
+	buf->growable = growable;
+	buf->events = malloc(max_events * sizeof(*buf->events));
+	AN(buf->events);
+	return buf;
+}
+
+static void trace_event(struct trace_buffer* buf, char phase, const char* name)
+{
+	if (buf == NULL) return;
+	if (buf->n_events == buf->max_events) {
+		if (!buf->growable) {
+			buf->n_dropped++;
+			return;
+		}
+		buf->max_events <<= 1;
+		buf->events = realloc(buf->events, buf->max_events * sizeof(*buf->events));
+		AN(buf->events);
+	}
+	struct trace_event* ev = &buf->events[buf->n_events++];
+	ev->ticks = SDL_GetPerformanceCounter();
+	ev->name = name;
+	ev->phase = phase;
+}
+
+#define TRACE_BEGIN(buf, name) trace_event(buf, 'B', name)
+#define TRACE_END(buf, name) trace_event(buf, 'E', name)
+#define TRACE_INSTANT(buf, name) trace_event(buf, 'i', name)
+
+// only call once every recording thread is done
+static void tracer_write(struct tracer* tracer, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: could not write trace\n", path);
+		return;
+	}
+	double us_per_tick = 1e6 / (double)SDL_GetPerformanceFrequency();
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	const char* sep = "";
+	for (int tid = 0; tid < tracer->n_buffers; tid++) {
+		struct trace_buffer* buf = &tracer->buffers[tid];
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", sep, tid, buf->thread_name);
+		sep = ",\n";
+		for (int i = 0; i < buf->n_events; i++) {
+			struct trace_event* ev = &buf->events[i];
+			double ts = (double)(int64_t)(ev->ticks - tracer->t0) * us_per_tick;
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d%s}",
+				sep, ev->name, ev->phase, ts, tid, ev->phase == 'i' ? ",\"s\":\"t\"" : "");
+		}
+		if (buf->n_dropped > 0) {
+			fprintf(stderr, "trace: %s buffer full, dropped %d events\n", buf->thread_name, buf->n_dropped);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
+
+
 struct drum_control_feedback {
 	uint32_t value;
 	uint32_t position;
@@ -178,6 +371,75 @@ struct drum_control_feedback {
 #define DRUM_CONTROL_FEEDBACK_N (1<<8)
 #define DRUM_CONTROL_FEEDBACK_MASK (DRUM_CONTROL_FEEDBACK_N-1)
 
+// the rng streams a round starts from
+enum replay_seed {
+	REPLAY_SEED_AUDIO = 0,
+	REPLAY_SEED_GIBLETS,
+	REPLAY_SEED_ZOMBIES,
+	REPLAY_SEED_MAX
+};
+
+static const char* replay_seed_names[REPLAY_SEED_MAX] = {"audio", "giblets", "zombies"};
+
+struct replay_skip {
+	uint64_t tick;
+	uint64_t to_tick;
+};
+
+struct replay_hash {
+	int second;
+	uint64_t hash;
+};
+
+// a round as --record saw it: every drum control the audio thread played,
+// keyed by the sample position it started sounding at, the seeds, the
+// simulation backlog drops, and a state hash per second of song. --replay
+// plays the drum controls back from the audio callback, so the game sees
+// the same feedback at the same positions however the frames fall
+struct replay {
+	int recording;
+	int playing;
+
+	uint32_t sample_rate;
+	int audio_buffer_length_exp;
+	uint32_t seeds[REPLAY_SEED_MAX];
+	uint32_t end_position;
+
+	struct drum_control_feedback* drums;
+	int n_drums;
+	int max_drums;
+	int next_drum; // playback; only touched by whoever runs audio_callback()
+
+	struct replay_skip* skips;
+	int n_skips;
+	int max_skips;
+	int next_skip;
+
+	struct replay_hash* hashes;
+	int n_hashes;
+	int max_hashes;
+	int next_hash;
+	int hashes_checked;
+	int hash_failures;
+};
+
+// playback: the drum controls recorded for the block starting at position
+static uint32_t replay_drum_control(struct replay* r, uint32_t position, int n)
+{
+	uint32_t drum_control = 0;
+	while (r->next_drum < r->n_drums && r->drums[r->next_drum].position < position + n) {
+		drum_control |= r->drums[r->next_drum++].value;
+	}
+	return drum_control;
+}
+
+// playback: continue with the drum controls from position on
+static void replay_seek_drums(struct replay* r, uint32_t position)
+{
+	r->next_drum = 0;
+	while (r->next_drum < r->n_drums && r->drums[r->next_drum].position < position) r->next_drum++;
+}
+
 
 struct sample_ctx {
 	struct sample* sample;
@@ -187,6 +449,7 @@ struct sample_ctx {
 };
 
 #define DRUM_CONTROL_RING_LENGTH (32)
+#define AUDIO_RNG_SEED (0)
 struct audio {
 	SDL_AudioDeviceID device;
 	uint32_t sample_rate;
@@ -211,6 +474,20 @@ struct audio {
 	uint32_t drum_control_ring[DRUM_CONTROL_RING_LENGTH];
 	uint32_t drum_control_write_cursor;
 	uint32_t drum_control_read_cursor;
+
+	// headless: no device; audio_pump() runs the callback on the caller's
+	// clock instead
+	int headless;
+	int headless_block_length;
+	float headless_accum;
+	float* headless_buffer;
+
+	// NULL unless tracing; only written by whoever runs audio_callback()
+	struct trace_buffer* trace;
+
+	// NULL unless replaying, in which case drums come from it instead of
+	// audio_emit_drum_control()
+	struct replay* replay;
 };
 
 static void audio_lock(struct audio* audio)
@@ -237,6 +514,8 @@ static void audio_callback(void* userdata, Uint8* stream_u8, int bytes)
 	float* stream = (float*)stream_u8;
 	int n = bytes / sizeof(float) / 2;
 
+	TRACE_BEGIN(audio->trace, "audio callback");
+
 	audio_lock(audio);
 	uint32_t drum_control = 0;
 	//printf("%d %d\n", audio->drum_control_read_cursor, audio->drum_control_write_cursor);
@@ -246,11 +525,13 @@ static void audio_callback(void* userdata, Uint8* stream_u8, int bytes)
 		audio->drum_control_read_cursor = (audio->drum_control_read_cursor + 1) & (DRUM_CONTROL_RING_LENGTH-1);
 	}
 	audio_unlock(audio);
+	if (audio->replay) drum_control = replay_drum_control(audio->replay, audio->position, n);
 
 	// trigger drums
 	for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
 		int m = 1<<drum_id;
 		if (drum_control & m) {
+			TRACE_INSTANT(audio->trace, drum_names[drum_id]);
 			struct sample_ctx* ctx = &audio->drum_sample_ctx[drum_id];
 			int di = drum_id*3 + rng_uint32(&audio->rng) % 3;
 			ctx->sample = &audio->drum_samples.samples[di];
@@ -315,6 +596,16 @@ static void audio_callback(void* userdata, Uint8* stream_u8, int bytes)
 
 	audio->position += n;
 
+	TRACE_END(audio->trace, "audio callback");
+}
+
+// audio->position counts device samples, and it's what the tracks are
+// read and seeked by (stb_vorbis_seek() in audio_load()) with no
+// resampling in between, so both tracks must be at the device rate
+static void audio_check_track_rate(struct audio* audio, stb_vorbis* track, const char* name)
+{
+	stb_vorbis_info info = stb_vorbis_get_info(track);
+	if (info.sample_rate != audio->sample_rate) arghf("%s is %u Hz but audio runs at %u Hz", name, info.sample_rate, audio->sample_rate);
 }
 
 static void audio_start(struct audio* audio, int audio_buffer_length_exp)
@@ -344,6 +635,22 @@ static void audio_start(struct audio* audio, int audio_buffer_length_exp)
 	stb_vorbis_seek_start(audio->bass_track);
 	stb_vorbis_seek_start(audio->guitar_track);
 
+	if (audio->headless) {
+		int samples = 256 << audio_buffer_length_exp;
+		audio->sample_rate = 44100;
+		audio->headless_block_length = samples;
+		audio->headless_accum = 0;
+		audio->bass_buffer = realloc(audio->bass_buffer, sizeof(float) * 2 * samples);
+		AN(audio->bass_buffer);
+		audio->guitar_buffer = realloc(audio->guitar_buffer, sizeof(float) * 2 * samples);
+		AN(audio->guitar_buffer);
+		audio->headless_buffer = realloc(audio->headless_buffer, sizeof(float) * 2 * samples);
+		AN(audio->headless_buffer);
+		audio_check_track_rate(audio, audio->bass_track, "basstrack");
+		audio_check_track_rate(audio, audio->guitar_track, "guitartrack");
+		return;
+	}
+
 	SDL_AudioSpec want, have;
 	want.freq = 44100;
 	want.format = AUDIO_F32;
@@ -364,6 +671,8 @@ static void audio_start(struct audio* audio, int audio_buffer_length_exp)
 	if (audio->device == 0) arghf("SDL_OpenAudioDevice: %s", SDL_GetError());
 
 	audio->sample_rate = have.freq;
+	audio_check_track_rate(audio, audio->bass_track, "basstrack");
+	audio_check_track_rate(audio, audio->guitar_track, "guitartrack");
 
 	if (audio->bass_buffer) free(audio->bass_buffer);
 	audio->bass_buffer = malloc(sizeof(float) * 2 * have.samples);
@@ -378,15 +687,17 @@ static void audio_start(struct audio* audio, int audio_buffer_length_exp)
 
 static void audio_stop(struct audio* audio)
 {
+	if (audio->headless) return;
 	SDL_PauseAudioDevice(audio->device, 1);
 	SDL_CloseAudioDevice(audio->device);
 }
 
-static void audio_init(struct audio* audio)
+static void audio_init(struct audio* audio, int headless)
 {
 	memset(audio, 0, sizeof(*audio));
+	audio->headless = headless;
 
-	rng_seed(&audio->rng, 0);
+	rng_seed(&audio->rng, AUDIO_RNG_SEED);
 
 	int vorbis_error;
 
@@ -406,7 +717,20 @@ static void audio_init(struct audio* audio)
 static void audio_quit(struct audio* audio)
 {
 	SDL_DestroyMutex(audio->mutex);
-	SDL_CloseAudioDevice(audio->device);
+	if (!audio->headless) SDL_CloseAudioDevice(audio->device);
+}
+
+// headless only: advance the audio clock by 1/fps seconds, in whole
+// callback-sized blocks like a real device would
+static void audio_pump(struct audio* audio, int fps)
+{
+	AN(audio->headless);
+	audio->headless_accum += (float)audio->sample_rate / (float)fps;
+	int n = audio->headless_block_length;
+	while (audio->headless_accum >= n) {
+		audio_callback(audio, (Uint8*)audio->headless_buffer, n * 2 * sizeof(float));
+		audio->headless_accum -= n;
+	}
 }
 
 static float audio_position_to_seconds(struct audio* audio, uint32_t position)
@@ -414,9 +738,252 @@ static float audio_position_to_seconds(struct audio* audio, uint32_t position)
 	return (float)position / (float)audio->sample_rate;
 }
 
+// keeps the callback out while the stream is inspected or moved
+static void audio_lock_device(struct audio* audio)
+{
+	if (!audio->headless) SDL_LockAudioDevice(audio->device);
+}
+
+static void audio_unlock_device(struct audio* audio)
+{
+	if (!audio->headless) SDL_UnlockAudioDevice(audio->device);
+}
+
+// the playback position and whatever drums are still ringing; drum
+// samples are saved by index
+static void audio_save(struct audio* audio, struct snapshot* s)
+{
+	audio_lock_device(audio);
+	SNAPSHOT_PUT(s, audio->rng);
+	SNAPSHOT_PUT(s, audio->position);
+	SNAPSHOT_PUT(s, audio->bass_stopped);
+	SNAPSHOT_PUT(s, audio->guitar_stopped);
+	SNAPSHOT_PUT(s, audio->headless_accum);
+	for (int i = 0; i < DRUM_ID_MAX; i++) {
+		struct sample_ctx* ctx = &audio->drum_sample_ctx[i];
+		int sample = ctx->sample ? (int)(ctx->sample - audio->drum_samples.samples) : -1;
+		SNAPSHOT_PUT(s, sample);
+		SNAPSHOT_PUT(s, ctx->position);
+		SNAPSHOT_PUT(s, ctx->playing);
+	}
+	audio_unlock_device(audio);
+}
+
+// seeks both tracks, and drops drum controls that haven't been played
+// yet; the feedback ring is left alone, readers should skip to its cursor
+static void audio_load(struct audio* audio, struct snapshot* s)
+{
+	audio_lock_device(audio);
+	SNAPSHOT_GET(s, audio->rng);
+	SNAPSHOT_GET(s, audio->position);
+	SNAPSHOT_GET(s, audio->bass_stopped);
+	SNAPSHOT_GET(s, audio->guitar_stopped);
+	SNAPSHOT_GET(s, audio->headless_accum);
+	for (int i = 0; i < DRUM_ID_MAX; i++) {
+		struct sample_ctx* ctx = &audio->drum_sample_ctx[i];
+		int sample;
+		SNAPSHOT_GET(s, sample);
+		SNAPSHOT_GET(s, ctx->position);
+		SNAPSHOT_GET(s, ctx->playing);
+		ctx->sample = sample >= 0 ? &audio->drum_samples.samples[sample] : NULL;
+	}
+	if (!stb_vorbis_seek(audio->bass_track, audio->position)) audio->bass_stopped = 1;
+	if (!stb_vorbis_seek(audio->guitar_track, audio->position)) audio->guitar_stopped = 1;
+	audio_lock(audio);
+	audio->drum_control_read_cursor = audio->drum_control_write_cursor;
+	audio_unlock(audio);
+	if (audio->replay) replay_seek_drums(audio->replay, audio->position);
+	audio_unlock_device(audio);
+}
+
+
+// a run of non color keyed pixels in an image row
+struct img_span {
+	int x;
+	int length;
+};
+
+// a source rectangle trimmed down to its opaque pixels; dx/dy is where
+// the trimmed box sits in the untrimmed one. w == 0: nothing to draw
+struct img_rect {
+	int x, y;
+	int w, h;
+	int dx, dy;
+};
+
+struct img {
+	uint32_t* data;
+	int width;
+	int height;
+	int bpp;
+
+	// optional, for images that never change: the spans of row y are
+	// spans[span_rows[y]] up to spans[span_rows[y+1]], in ascending x.
+	// lets color keyed blits and flashes skip transparent pixels
+	struct img_span* spans;
+	int* span_rows;
+
+	// optional, for sprite sheets on a regular grid: every cell trimmed
+	// to its opaque pixels, see img_set_cells()
+	int cell_w;
+	int cell_h;
+	struct img_rect* cells;
+};
+
+// may be called again after the pixels change; the span arrays are reused
+static void img_build_spans(struct img* img)
+{
+	int n_spans = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		n_spans = 0;
+		for (int y = 0; y < img->height; y++) {
+			if (pass == 1) img->span_rows[y] = n_spans;
+			uint32_t* row = img->data + y * img->width;
+			int x = 0;
+			while (x < img->width) {
+				if ((row[x] & 0xffffff) == 0xff00ff) {
+					x++;
+					continue;
+				}
+				int x0 = x;
+				while (x < img->width && (row[x] & 0xffffff) != 0xff00ff) x++;
+				if (pass == 1) {
+					img->spans[n_spans].x = x0;
+					img->spans[n_spans].length = x - x0;
+				}
+				n_spans++;
+			}
+		}
+		if (pass == 0) {
+			img->spans = realloc(img->spans, (n_spans + 1) * sizeof(*img->spans));
+			AN(img->spans);
+			img->span_rows = realloc(img->span_rows, (img->height + 1) * sizeof(*img->span_rows));
+			AN(img->span_rows);
+		}
+	}
+	img->span_rows[img->height] = n_spans;
+}
+
+static struct img_rect img_trim(struct img* img, int x0, int y0, int w, int h)
+{
+	AN(img->spans);
+	int min_x = x0 + w;
+	int max_x = x0;
+	int min_y = y0 + h;
+	int max_y = y0;
+	for (int y = y0; y < y0 + h; y++) {
+		struct img_span* span = &img->spans[img->span_rows[y]];
+		struct img_span* end = &img->spans[img->span_rows[y + 1]];
+		for (; span < end && span->x < x0 + w; span++) {
+			int a = span->x > x0 ? span->x : x0;
+			int b = span->x + span->length;
+			if (b > x0 + w) b = x0 + w;
+			if (a >= b) continue;
+			if (a < min_x) min_x = a;
+			if (b > max_x) max_x = b;
+			if (y < min_y) min_y = y;
+			if (y + 1 > max_y) max_y = y + 1;
+		}
+	}
+	struct img_rect r;
+	memset(&r, 0, sizeof(r));
+	if (max_x <= min_x) return r;
+	r.x = min_x;
+	r.y = min_y;
+	r.w = max_x - min_x;
+	r.h = max_y - min_y;
+	r.dx = min_x - x0;
+	r.dy = min_y - y0;
+	return r;
+}
+
+// draws of exactly one cell get trimmed to it (or dropped if it's empty)
+static void img_set_cells(struct img* img, int cell_w, int cell_h)
+{
+	int nx = img->width / cell_w;
+	int ny = img->height / cell_h;
+	img->cell_w = cell_w;
+	img->cell_h = cell_h;
+	img->cells = malloc(nx * ny * sizeof(*img->cells));
+	AN(img->cells);
+	for (int cy = 0; cy < ny; cy++) {
+		for (int cx = 0; cx < nx; cx++) {
+			img->cells[cx + cy * nx] = img_trim(img, cx * cell_w, cy * cell_h, cell_w, cell_h);
+		}
+	}
+}
+
+static void img_load(struct img* img, const char* asset)
+{
+	memset(img, 0, sizeof(*img));
+	img->data = (uint32_t*)stbi_load(asset_path(asset), &img->width, &img->height, &img->bpp, 4);
+	AN(img->data);
+	img_build_spans(img);
+}
+
+// for loaded and built images alike; both are plain malloc'd data
+static void img_free(struct img* img)
+{
+	free(img->data);
+	free(img->spans);
+	free(img->span_rows);
+	free(img->cells);
+	memset(img, 0, sizeof(*img));
+}
+
+
+// solid fill, clipped to the image; for images we render into
+static void img_fill_rect(struct img* img, int x0, int y0, int w, int h, uint32_t color)
+{
+	if (x0 < 0) {
+		w += x0;
+		x0 = 0;
+	}
+	if (y0 < 0) {
+		h += y0;
+		y0 = 0;
+	}
+	if (x0 + w > img->width) w = img->width - x0;
+	if (y0 + h > img->height) h = img->height - y0;
+	for (int y = 0; y < h; y++) {
+		uint32_t* row = img->data + x0 + (y0 + y) * img->width;
+		for (int x = 0; x < w; x++) row[x] = color;
+	}
+}
+
+// color keyed copy between images, clipped to the destination
+static void img_blit(struct img* dst, struct img* src, int x0, int y0, int x1, int y1, int w, int h)
+{
+	if (x1 < 0) {
+		w += x1;
+		x0 -= x1;
+		x1 = 0;
+	}
+	if (y1 < 0) {
+		h += y1;
+		y0 -= y1;
+		y1 = 0;
+	}
+	if (x1 + w > dst->width) w = dst->width - x1;
+	if (y1 + h > dst->height) h = dst->height - y1;
+	for (int y = 0; y < h; y++) {
+		uint32_t* s = src->data + x0 + (y0 + y) * src->width;
+		uint32_t* d = dst->data + x1 + (y1 + y) * dst->width;
+		for (int x = 0; x < w; x++) {
+			if ((s[x] & 0xffffff) != 0xff00ff) d[x] = s[x];
+		}
+	}
+}
+
 
 #define MAX_PLAYED_NOTES (256)
 
+#define PIANO_ROLL_WIDTH_IN_SECONDS (5.0f)
+#define PIANO_ROLL_OFFSET_IN_SECONDS (1.05f)
+// rows covered by the pre-rendered lanes (bar ticks, lanes and notes)
+#define PIANO_ROLL_LANES_Y (8)
+#define PIANO_ROLL_LANES_HEIGHT (52)
+
 struct played_note {
 	float time_in_seconds;
 	uint32_t drum_id;
@@ -425,19 +992,31 @@ struct played_note {
 struct piano_roll {
 	struct song* song;
 
+	// bars, beat ticks and the whole chart, pre-rendered at song load
+	// so rendering is a scrolling blit no matter how dense the chart is
+	struct img lanes;
+	int lanes_first_beat;
+
 	// state
 	float time_in_seconds;
 	struct played_note* played_notes;
 	float gauge;
 	int gauge_last_step;
+	// drum control feedback the simulation hasn't caught up to yet
+	struct drum_control_feedback pending[DRUM_CONTROL_FEEDBACK_N];
+	int pending_read;
+	int pending_write;
 };
 
+static void piano_roll_render_lanes(struct piano_roll* p);
+
 static void piano_roll_init(struct piano_roll* p, struct song* song)
 {
 	memset(p, 0, sizeof(*p));
 	p->song = song;
 	p->played_notes = calloc(MAX_PLAYED_NOTES, sizeof(*p->played_notes));
 	AN(p->played_notes);
+	piano_roll_render_lanes(p);
 }
 
 static void piano_roll_reset(struct piano_roll* p)
@@ -446,6 +1025,8 @@ static void piano_roll_reset(struct piano_roll* p)
 	p->gauge = 1.0f;
 	p->gauge_last_step = 0;
 	memset(p->played_notes, 0, sizeof(*p->played_notes) * MAX_PLAYED_NOTES);
+	p->pending_read = 0;
+	p->pending_write = 0;
 }
 
 static void piano_roll_update_position(struct piano_roll* p, struct audio* audio, uint32_t audio_position)
@@ -542,12 +1123,63 @@ static void piano_roll_register_drum_control_feedback(struct piano_roll* p, stru
 	}
 }
 
+static void piano_roll_queue_drum_control_feedback(struct piano_roll* p, struct drum_control_feedback* fb)
+{
+	int next = (p->pending_write + 1) & DRUM_CONTROL_FEEDBACK_MASK;
+	ASSERT(next != p->pending_read);
+	p->pending[p->pending_write] = *fb;
+	p->pending_write = next;
+}
+
+// registers the queued feedback from blocks that started before position
+// and scores the gauge up to it; called once per simulation step, so the
+// gauge only depends on audio positions, not on how frames fall
+static void piano_roll_advance(struct piano_roll* p, struct audio* audio, uint32_t position)
+{
+	while (p->pending_read != p->pending_write && p->pending[p->pending_read].position < position) {
+		piano_roll_register_drum_control_feedback(p, audio, &p->pending[p->pending_read]);
+		p->pending_read = (p->pending_read + 1) & DRUM_CONTROL_FEEDBACK_MASK;
+	}
+	piano_roll_update_position(p, audio, position);
+	piano_roll_update_gauge(p);
+}
+
+// time_in_seconds follows the frames, so it's left out
+static uint64_t piano_roll_hash(struct piano_roll* p, uint64_t h)
+{
+	h = hash_bytes(h, &p->gauge, sizeof(p->gauge));
+	h = hash_bytes(h, &p->gauge_last_step, sizeof(p->gauge_last_step));
+	return hash_bytes(h, p->played_notes, sizeof(*p->played_notes) * MAX_PLAYED_NOTES);
+}
+
+static void piano_roll_save(struct piano_roll* p, struct snapshot* s)
+{
+	SNAPSHOT_PUT(s, p->time_in_seconds);
+	SNAPSHOT_PUT(s, p->gauge);
+	SNAPSHOT_PUT(s, p->gauge_last_step);
+	snapshot_put(s, p->played_notes, sizeof(*p->played_notes) * MAX_PLAYED_NOTES);
+	SNAPSHOT_PUT(s, p->pending);
+	SNAPSHOT_PUT(s, p->pending_read);
+	SNAPSHOT_PUT(s, p->pending_write);
+}
+
+static void piano_roll_load(struct piano_roll* p, struct snapshot* s)
+{
+	SNAPSHOT_GET(s, p->time_in_seconds);
+	SNAPSHOT_GET(s, p->gauge);
+	SNAPSHOT_GET(s, p->gauge_last_step);
+	snapshot_get(s, p->played_notes, sizeof(*p->played_notes) * MAX_PLAYED_NOTES);
+	SNAPSHOT_GET(s, p->pending);
+	SNAPSHOT_GET(s, p->pending_read);
+	SNAPSHOT_GET(s, p->pending_write);
+}
+
 static uint32_t mkcol(int r, int g, int b)
 {
 	return (r&255) + ((g&255)<<8) + ((b&255)<<16);
 }
 
-static int screen_clip_rect(int* x0, int* y0, int* w, int* h, int* xmod, int* ymod)
+static int screen_clip_rect(int* x0, int* y0, int* w, int* h, int* xmod, int* ymod, int clip_y0, int clip_y1)
 {
 	AN(x0);
 	AN(y0);
@@ -555,7 +1187,7 @@ static int screen_clip_rect(int* x0, int* y0, int* w, int* h, int* xmod, int* ym
 	AN(h);
 
 	if (*x0 >= SCREEN_WIDTH) return 0;
-	if (*y0 >= SCREEN_HEIGHT) return 0;
+	if (*y0 >= clip_y1) return 0;
 
 	if (*x0 < 0) {
 		*w += *x0;
@@ -563,144 +1195,969 @@ static int screen_clip_rect(int* x0, int* y0, int* w, int* h, int* xmod, int* ym
 		*x0 = 0;
 	}
 
-	if (*y0 < 0) {
-		*h += *y0;
-		if (ymod) *ymod -= *y0;
-		*y0 = 0;
+	if (*y0 < clip_y0) {
+		*h -= clip_y0 - *y0;
+		if (ymod) *ymod += clip_y0 - *y0;
+		*y0 = clip_y0;
 	}
 
 	if (*x0 + *w >= SCREEN_WIDTH) *w -= *x0 + *w - SCREEN_WIDTH;
-	if (*y0 + *h >= SCREEN_HEIGHT) *h -= *y0 + *h - SCREEN_HEIGHT;
+	if (*y0 + *h >= clip_y1) *h -= *y0 + *h - clip_y1;
 
 	if (*w <= 0 || *h <= 0) return 0;
 
 	return 1;
 }
 
-static void screen_draw_rect(uint32_t* screen, int x0, int y0, int w, int h, uint32_t color)
-{
-	if (!screen_clip_rect(&x0, &y0, &w, &h, NULL, NULL)) return;
-	
-	int i = x0 + y0 * SCREEN_WIDTH;
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			screen[i++] = color;
-		}
-		i += SCREEN_WIDTH - w;
-	}
-}
+/*
+   drawing doesn't touch pixels right away; screen_draw_*() record render
+   commands in paint order, and screen_end_frame() rasterizes the list once
+   per horizontal band of the framebuffer, one band per thread. every
+   command is clipped against the band it's rasterized into, so bands never
+   write the same pixels and paint order is preserved within each band
+*/
 
-struct img {
-	uint32_t* data;
-	int width;
-	int height;
-	int bpp;
+#define RENDER_CMD_RECT (0)
+#define RENDER_CMD_IMG (1) // color keyed
+#define RENDER_CMD_IMG_COLOR (2) // color keyed, solid color
+#define RENDER_CMD_IMG_OPAQUE (3) // no color key; backgrounds
+
+#define RENDER_MAX_THREADS (8)
+
+// opaque draws the rasterizer culls earlier commands against
+#define SCREEN_MAX_OCCLUDERS (8)
+
+// pool sizes the scaling benchmarks compare
+#define BENCH_POOLS (4)
+static const int bench_pool_threads[BENCH_POOLS] = {1, 2, 4, 8};
+
+struct render_cmd {
+	int type;
+	struct img* img;
+	int x0, y0; // source
+	int x1, y1; // destination
+	int w, h;
+	uint32_t color;
 };
 
+struct render_pool;
+
+struct screen {
+	// framebuffer is (SCREEN_WIDTH*scale)x(SCREEN_HEIGHT*scale); commands are
+	// always in SCREEN_WIDTHxSCREEN_HEIGHT coordinates
+	uint32_t* pixels;
+	int pitch; // in pixels
+	int scale;
+	// buffer allocated by screen_init; pixels points here unless
+	// screen_set_target() borrowed a locked texture for the frame
+	uint32_t* own_pixels;
+	int own_pitch;
+
+	struct render_cmd* cmds;
+	int n_cmds;
+	int max_cmds;
+
+	// indices of the largest opaque commands of the frame; anything queued
+	// before one of them and covered by it within a band is skipped there
+	int occluders[SCREEN_MAX_OCCLUDERS];
+	int n_occluders;
+
+	struct render_pool* pool;
+
+	// source pixels the rasterizer visited in the last frame, per band
+	// and in total
+	int band_pixel_visits[RENDER_MAX_THREADS];
+	int pixel_visits;
+};
 
-static void img_load(struct img* img, const char* asset)
+struct render_worker {
+	struct render_pool* pool;
+	SDL_Thread* thread;
+	SDL_sem* go;
+	int band;
+	struct trace_buffer* trace;
+};
+
+// a band job processes band number `band` out of `n_bands`
+typedef void (*render_band_fn)(void* userdata, int band, int n_bands);
+
+struct render_pool {
+	int n_threads;
+	struct render_worker* workers;
+	SDL_sem* done;
+	render_band_fn fn;
+	void* userdata;
+	int quit;
+};
+
+static void screen_init(struct screen* screen, int scale)
 {
-	img->data = (uint32_t*)stbi_load(asset_path(asset), &img->width, &img->height, &img->bpp, 4);
-	AN(img->data);
+	memset(screen, 0, sizeof(*screen));
+	ASSERT(scale >= 1);
+	screen->scale = scale;
+	screen->pitch = SCREEN_WIDTH * scale;
+	screen->own_pixels = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * scale * scale * sizeof(uint32_t));
+	AN(screen->own_pixels);
+	screen->own_pitch = screen->pitch;
+	screen->pixels = screen->own_pixels;
+	screen->max_cmds = 1024;
+	screen->cmds = malloc(screen->max_cmds * sizeof(*screen->cmds));
+	AN(screen->cmds);
 }
 
-
-static void screen_draw_img(uint32_t* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h)
+static void screen_free(struct screen* screen)
 {
-	if (!screen_clip_rect(&x1, &y1, &w, &h, &x0, &y0)) return;
+	free(screen->own_pixels);
+	free(screen->cmds);
+	memset(screen, 0, sizeof(*screen));
+}
 
-	int i0 = x0 + y0 * img->width;
-	int i1 = x1 + y1 * SCREEN_WIDTH;
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			uint32_t s0 = img->data[i0];
-			if ((s0 & 0xffffff) != 0xff00ff) screen[i1] = s0;
-			i0++;
-			i1++;
-		}
-		i0 += img->width - w;
-		i1 += SCREEN_WIDTH - w;
+static struct render_cmd* screen_push_cmd(struct screen* screen, int type)
+{
+	if (screen->n_cmds >= screen->max_cmds) {
+		screen->max_cmds <<= 1;
+		screen->cmds = realloc(screen->cmds, screen->max_cmds * sizeof(*screen->cmds));
+		AN(screen->cmds);
 	}
+	struct render_cmd* cmd = &screen->cmds[screen->n_cmds++];
+	cmd->type = type;
+	return cmd;
 }
 
-static void screen_draw_img_color(uint32_t* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h, uint32_t color)
+static int screen_offscreen(int x, int y, int w, int h)
 {
-	if (!screen_clip_rect(&x1, &y1, &w, &h, &x0, &y0)) return;
+	return w <= 0 || h <= 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT || x + w <= 0 || y + h <= 0;
+}
 
-	int i0 = x0 + y0 * img->width;
-	int i1 = x1 + y1 * SCREEN_WIDTH;
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			uint32_t s0 = img->data[i0];
-			if ((s0 & 0xffffff) != 0xff00ff) screen[i1] = color;
-			i0++;
-			i1++;
-		}
-		i0 += img->width - w;
-		i1 += SCREEN_WIDTH - w;
+// called after pushing an opaque command. a full screen one hides
+// everything queued before it, so those are dropped right away; smaller
+// ones are remembered (keeping the largest) for screen_raster_band()
+static void screen_occlude(struct screen* screen)
+{
+	int i = screen->n_cmds - 1;
+	struct render_cmd* cmd = &screen->cmds[i];
+	if (cmd->x1 <= 0 && cmd->y1 <= 0 && cmd->x1 + cmd->w >= SCREEN_WIDTH && cmd->y1 + cmd->h >= SCREEN_HEIGHT) {
+		screen->cmds[0] = *cmd;
+		screen->n_cmds = 1;
+		screen->n_occluders = 0;
+		return;
+	}
+	if (screen->n_occluders < SCREEN_MAX_OCCLUDERS) {
+		screen->occluders[screen->n_occluders++] = i;
+		return;
 	}
+	int smallest = 0;
+	for (int k = 1; k < SCREEN_MAX_OCCLUDERS; k++) {
+		struct render_cmd* a = &screen->cmds[screen->occluders[k]];
+		struct render_cmd* b = &screen->cmds[screen->occluders[smallest]];
+		if (a->w * a->h < b->w * b->h) smallest = k;
+	}
+	struct render_cmd* s = &screen->cmds[screen->occluders[smallest]];
+	if (cmd->w * cmd->h > s->w * s->h) screen->occluders[smallest] = i;
 }
 
-static void screen_draw_img_pain(uint32_t* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h, int pain)
+static void screen_draw_rect(struct screen* screen, int x0, int y0, int w, int h, uint32_t color)
 {
-	if (pain) {
-		screen_draw_img_color(screen, img, x0, y0, x1, y1, w, h, mkcol(255,255,255));
-	} else {
-		screen_draw_img(screen, img, x0, y0, x1, y1, w, h);
-	}
+	if (screen_offscreen(x0, y0, w, h)) return;
+	struct render_cmd* cmd = screen_push_cmd(screen, RENDER_CMD_RECT);
+	cmd->img = NULL;
+	cmd->x1 = x0;
+	cmd->y1 = y0;
+	cmd->w = w;
+	cmd->h = h;
+	cmd->color = color;
+	screen_occlude(screen);
 }
 
-struct font {
-	struct img img;
-	int x0;
-	int x;
-	int y;
-	char* buffer;
-	uint32_t color;
-};
+static void screen_push_img_cmd(struct screen* screen, int type, struct img* img, int x0, int y0, int x1, int y1, int w, int h, uint32_t color)
+{
+	if (img->cells != NULL && type != RENDER_CMD_IMG_OPAQUE
+		&& w == img->cell_w && h == img->cell_h && (x0 % w) == 0 && (y0 % h) == 0
+		&& x0 + w <= img->width && y0 + h <= img->height) {
+		struct img_rect* r = &img->cells[x0 / w + (y0 / h) * (img->width / w)];
+		x0 = r->x;
+		y0 = r->y;
+		x1 += r->dx;
+		y1 += r->dy;
+		w = r->w;
+		h = r->h;
+	}
+	if (screen_offscreen(x1, y1, w, h)) return;
+	struct render_cmd* cmd = screen_push_cmd(screen, type);
+	cmd->img = img;
+	cmd->x0 = x0;
+	cmd->y0 = y0;
+	cmd->x1 = x1;
+	cmd->y1 = y1;
+	cmd->w = w;
+	cmd->h = h;
+	cmd->color = color;
+	if (type == RENDER_CMD_IMG_OPAQUE) screen_occlude(screen);
+}
 
-static void font_init(struct font* font)
+static void screen_draw_img(struct screen* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h)
 {
-	memset(font, 0, sizeof(*font));
-	img_load(&font->img, "font6.png");
-	font->buffer = malloc(4096);
-	AN(font->buffer);
+	screen_push_img_cmd(screen, RENDER_CMD_IMG, img, x0, y0, x1, y1, w, h, 0);
 }
 
-static void font_set_color(struct font* font, uint32_t color)
+static void screen_draw_img_color(struct screen* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h, uint32_t color)
 {
-	font->color = color;
+	screen_push_img_cmd(screen, RENDER_CMD_IMG_COLOR, img, x0, y0, x1, y1, w, h, color);
 }
 
-static void font_set_cursor(struct font* font, int x, int y)
+static void screen_draw_img_opaque(struct screen* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h)
 {
-	font->x0 = x;
-	font->x = x;
-	font->y = y;
+	screen_push_img_cmd(screen, RENDER_CMD_IMG_OPAQUE, img, x0, y0, x1, y1, w, h, 0);
 }
 
-void font_printf(struct font* font, uint32_t* screen, const char* fmt, ...) __attribute__((format (printf, 3, 4)));
-void font_printf(struct font* font, uint32_t* screen, const char* fmt, ...)
+static void screen_draw_img_pain(struct screen* screen, struct img* img, int x0, int y0, int x1, int y1, int w, int h, int pain)
 {
-	va_list args;
-	va_start(args, fmt);
-	int n = vsprintf(font->buffer, fmt, args);
-	for (int i = 0; i < n; i++) {
-		unsigned char ch = font->buffer[i];
+	if (pain) {
+		screen_draw_img_color(screen, img, x0, y0, x1, y1, w, h, mkcol(255,255,255));
+	} else {
+		screen_draw_img(screen, img, x0, y0, x1, y1, w, h);
+	}
+}
+
+// returns the number of source pixels visited
+static int screen_raster_cmd(struct screen* screen, struct render_cmd* cmd, int clip_y0, int clip_y1)
+{
+	int x0 = cmd->x0;
+	int y0 = cmd->y0;
+	int x1 = cmd->x1;
+	int y1 = cmd->y1;
+	int w = cmd->w;
+	int h = cmd->h;
+	if (!screen_clip_rect(&x1, &y1, &w, &h, &x0, &y0, clip_y0, clip_y1)) return 0;
+
+	int s = screen->scale;
+	int pitch = screen->pitch;
+	uint32_t* dst = screen->pixels + y1 * s * pitch + x1 * s;
+	uint32_t color = cmd->color;
+
+	if (cmd->type == RENDER_CMD_RECT) {
+		for (int y = 0; y < h*s; y++) {
+			for (int x = 0; x < w*s; x++) dst[x] = color;
+			dst += pitch;
+		}
+		return w * h;
+	}
+
+	struct img* img = cmd->img;
+	uint32_t* src = img->data + x0 + y0 * img->width;
+	int type = cmd->type;
+
+	if (type != RENDER_CMD_IMG_OPAQUE && img->spans != NULL) {
+		int visits = 0;
+		for (int y = 0; y < h; y++) {
+			int row = y0 + y;
+			struct img_span* span = &img->spans[img->span_rows[row]];
+			struct img_span* end = &img->spans[img->span_rows[row + 1]];
+			for (; span < end && span->x < x0 + w; span++) {
+				int a = span->x > x0 ? span->x : x0;
+				int b = span->x + span->length;
+				if (b > x0 + w) b = x0 + w;
+				if (a >= b) continue;
+				visits += b - a;
+				uint32_t* d = dst + (a - x0) * s;
+				if (type == RENDER_CMD_IMG && s == 1) {
+					memcpy(d, src + (a - x0), (b - a) * sizeof(uint32_t));
+					continue;
+				}
+				if (type == RENDER_CMD_IMG) {
+					uint32_t* dd = d;
+					for (int x = a - x0; x < b - x0; x++) {
+						uint32_t s0 = src[x];
+						for (int sx = 0; sx < s; sx++) *(dd++) = s0;
+					}
+				} else {
+					for (int i = 0; i < (b - a) * s; i++) d[i] = color;
+				}
+				// spans are fully opaque, so the other scaled rows are copies
+				for (int sy = 1; sy < s; sy++) {
+					memcpy(d + sy * pitch, d, (b - a) * s * sizeof(uint32_t));
+				}
+			}
+			src += img->width;
+			dst += pitch * s;
+		}
+		return visits;
+	}
+
+	if (s == 1) {
+		for (int y = 0; y < h; y++) {
+			switch (type) {
+			case RENDER_CMD_IMG:
+				for (int x = 0; x < w; x++) {
+					uint32_t s0 = src[x];
+					if ((s0 & 0xffffff) != 0xff00ff) dst[x] = s0;
+				}
+				break;
+			case RENDER_CMD_IMG_COLOR:
+				for (int x = 0; x < w; x++) {
+					if ((src[x] & 0xffffff) != 0xff00ff) dst[x] = color;
+				}
+				break;
+			case RENDER_CMD_IMG_OPAQUE:
+				memcpy(dst, src, w * sizeof(uint32_t));
+				break;
+			}
+			src += img->width;
+			dst += pitch;
+		}
+		return w * h;
+	}
+
+	for (int y = 0; y < h; y++) {
+		for (int sy = 0; sy < s; sy++) {
+			if (sy > 0 && type == RENDER_CMD_IMG_OPAQUE) {
+				memcpy(dst, dst - pitch, w * s * sizeof(uint32_t));
+				dst += pitch;
+				continue;
+			}
+			uint32_t* d = dst;
+			for (int x = 0; x < w; x++) {
+				uint32_t s0 = src[x];
+				if (type != RENDER_CMD_IMG_OPAQUE && (s0 & 0xffffff) == 0xff00ff) {
+					d += s;
+					continue;
+				}
+				if (type == RENDER_CMD_IMG_COLOR) s0 = color;
+				for (int sx = 0; sx < s; sx++) *(d++) = s0;
+			}
+			dst += pitch;
+		}
+		src += img->width;
+	}
+	return w * h;
+}
+
+static void screen_raster_band(void* userdata, int band, int n_bands)
+{
+	struct screen* screen = userdata;
+	int clip_y0 = (band * SCREEN_HEIGHT) / n_bands;
+	int clip_y1 = ((band + 1) * SCREEN_HEIGHT) / n_bands;
+	int visits = 0;
+
+	// occluder rects clipped to this band
+	struct { int i, x0, y0, x1, y1; } occ[SCREEN_MAX_OCCLUDERS];
+	int n_occ = 0;
+	for (int k = 0; k < screen->n_occluders; k++) {
+		struct render_cmd* o = &screen->cmds[screen->occluders[k]];
+		int x = o->x1, y = o->y1, w = o->w, h = o->h;
+		if (!screen_clip_rect(&x, &y, &w, &h, NULL, NULL, clip_y0, clip_y1)) continue;
+		occ[n_occ].i = screen->occluders[k];
+		occ[n_occ].x0 = x;
+		occ[n_occ].y0 = y;
+		occ[n_occ].x1 = x + w;
+		occ[n_occ].y1 = y + h;
+		n_occ++;
+	}
+
+	for (int i = 0; i < screen->n_cmds; i++) {
+		struct render_cmd* cmd = &screen->cmds[i];
+		int x = cmd->x1, y = cmd->y1, w = cmd->w, h = cmd->h;
+		if (!screen_clip_rect(&x, &y, &w, &h, NULL, NULL, clip_y0, clip_y1)) continue;
+		int covered = 0;
+		for (int k = 0; k < n_occ && !covered; k++) {
+			covered = occ[k].i > i && occ[k].x0 <= x && occ[k].y0 <= y && occ[k].x1 >= x + w && occ[k].y1 >= y + h;
+		}
+		if (covered) continue;
+		visits += screen_raster_cmd(screen, cmd, clip_y0, clip_y1);
+	}
+	screen->band_pixel_visits[band] = visits;
+}
+
+static int render_worker_run(void* userdata)
+{
+	struct render_worker* worker = userdata;
+	struct render_pool* pool = worker->pool;
+	for (;;) {
+		SAZ(SDL_SemWait(worker->go));
+		if (pool->quit) break;
+		TRACE_BEGIN(worker->trace, "band");
+		pool->fn(pool->userdata, worker->band, pool->n_threads);
+		TRACE_END(worker->trace, "band");
+		SAZ(SDL_SemPost(pool->done));
+	}
+	return 0;
+}
+
+static void render_pool_init(struct render_pool* pool, int n_threads)
+{
+	memset(pool, 0, sizeof(*pool));
+	if (n_threads < 1) n_threads = 1;
+	if (n_threads > RENDER_MAX_THREADS) n_threads = RENDER_MAX_THREADS;
+	pool->n_threads = n_threads;
+	pool->done = SDL_CreateSemaphore(0);
+	SAN(pool->done);
+	pool->workers = calloc(n_threads, sizeof(*pool->workers));
+	AN(pool->workers);
+	// band 0 is rasterized by the calling thread
+	for (int i = 1; i < n_threads; i++) {
+		struct render_worker* worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->band = i;
+		worker->go = SDL_CreateSemaphore(0);
+		SAN(worker->go);
+		worker->thread = SDL_CreateThread(render_worker_run, "render", worker);
+		SAN(worker->thread);
+	}
+}
+
+static void render_pool_quit(struct render_pool* pool)
+{
+	pool->quit = 1;
+	for (int i = 1; i < pool->n_threads; i++) {
+		struct render_worker* worker = &pool->workers[i];
+		SAZ(SDL_SemPost(worker->go));
+		SDL_WaitThread(worker->thread, NULL);
+		SDL_DestroySemaphore(worker->go);
+	}
+	SDL_DestroySemaphore(pool->done);
+	free(pool->workers);
+}
+
+// point the screen at other memory, e.g. a locked streaming texture
+static void screen_set_target(struct screen* screen, uint32_t* pixels, int pitch)
+{
+	screen->pixels = pixels;
+	screen->pitch = pitch;
+}
+
+// back to the owned buffer; call once the borrowed target is unlocked
+static void screen_reset_target(struct screen* screen)
+{
+	screen->pixels = screen->own_pixels;
+	screen->pitch = screen->own_pitch;
+}
+
+static void screen_begin_frame(struct screen* screen)
+{
+	screen->n_cmds = 0;
+	screen->n_occluders = 0;
+}
+
+// gives every worker thread a trace buffer of its own
+// band 0 runs on the calling thread, so it goes into that thread's buffer
+static void render_pool_trace(struct render_pool* pool, struct tracer* tracer, struct trace_buffer* caller_trace)
+{
+	pool->workers[0].trace = caller_trace;
+	for (int i = 1; i < pool->n_threads; i++) {
+		pool->workers[i].trace = tracer_add_buffer(tracer, "render", 1<<18, 0);
+	}
+}
+
+// runs fn for every band, one band per thread, and waits for all of them
+static void render_pool_run(struct render_pool* pool, render_band_fn fn, void* userdata)
+{
+	if (pool == NULL) {
+		fn(userdata, 0, 1);
+		return;
+	}
+	struct trace_buffer* trace = pool->workers[0].trace;
+	if (pool->n_threads == 1) {
+		TRACE_BEGIN(trace, "band");
+		fn(userdata, 0, 1);
+		TRACE_END(trace, "band");
+		return;
+	}
+	pool->fn = fn;
+	pool->userdata = userdata;
+	for (int i = 1; i < pool->n_threads; i++) SAZ(SDL_SemPost(pool->workers[i].go));
+	TRACE_BEGIN(trace, "band");
+	fn(userdata, 0, pool->n_threads);
+	TRACE_END(trace, "band");
+	for (int i = 1; i < pool->n_threads; i++) SAZ(SDL_SemWait(pool->done));
+}
+
+// a job processes chunk number `job` of a batch; which thread runs it is
+// up to the pool, so jobs must only write to memory of their own chunk
+typedef void (*render_job_fn)(void* userdata, int job);
+
+// a per-job result padded to a cache line, so jobs on different threads
+// don't write to the same line
+#define CACHE_LINE_SIZE (64)
+struct job_count {
+	int n;
+	char pad[CACHE_LINE_SIZE - sizeof(int)];
+};
+
+struct render_jobs {
+	render_job_fn fn;
+	void* userdata;
+	int n_jobs;
+	SDL_atomic_t next_job;
+};
+
+// band b starts with job b, then every band takes the next job past the
+// first n_bands off the shared counter as soon as it's done with one
+static void render_jobs_band(void* userdata, int band, int n_bands)
+{
+	struct render_jobs* jobs = userdata;
+	for (int job = band; job < jobs->n_jobs; job = n_bands + SDL_AtomicAdd(&jobs->next_job, 1)) {
+		jobs->fn(jobs->userdata, job);
+	}
+}
+
+// runs fn for jobs 0 to n_jobs-1 on the pool's threads and waits for all
+// of them. jobs are fixed size chunks of uniform work (physics steps,
+// walker updates), so a shared counter balances them as well as work
+// stealing would, with one atomic add per job and no per-thread queues
+static void render_pool_run_jobs(struct render_pool* pool, render_job_fn fn, void* userdata, int n_jobs)
+{
+	if (pool == NULL || pool->n_threads == 1 || n_jobs <= 1) {
+		for (int job = 0; job < n_jobs; job++) fn(userdata, job);
+		return;
+	}
+	struct render_jobs jobs;
+	jobs.fn = fn;
+	jobs.userdata = userdata;
+	jobs.n_jobs = n_jobs;
+	SDL_AtomicSet(&jobs.next_job, 0);
+	render_pool_run(pool, render_jobs_band, &jobs);
+}
+
+static void screen_rasterize(struct screen* screen)
+{
+	memset(screen->band_pixel_visits, 0, sizeof(screen->band_pixel_visits));
+	render_pool_run(screen->pool, screen_raster_band, screen);
+	screen->pixel_visits = 0;
+	for (int i = 0; i < RENDER_MAX_THREADS; i++) screen->pixel_visits += screen->band_pixel_visits[i];
+}
+
+static void screen_end_frame(struct screen* screen)
+{
+	screen_rasterize(screen);
+}
+
+#define FONT_BUFFER_SIZE (4096)
+#define FONT_RUN_CACHE_SIZE (256)
+#define FONT_RUN_PROBES (8)
+
+// a formatted string pre-rasterized in its color, so it is drawn with a
+// single color keyed blit instead of one command per glyph
+struct font_run {
+	char* text; // NULL: free slot
+	uint32_t hash;
+	uint32_t color;
+	int dx; // x where the first line starts, relative to the left margin
+	int frame; // last frame it was drawn; runs in use are never evicted
+	struct img img;
+	int capacity; // in pixels
+};
+
+struct font {
+	struct img img;
+	int x0;
+	int x;
+	int y;
+	char* buffer;
+	uint32_t color;
+
+	int frame;
+	struct font_run* runs;
+};
+
+static void font_init(struct font* font)
+{
+	memset(font, 0, sizeof(*font));
+	img_load(&font->img, "font6.png");
+	font->buffer = malloc(FONT_BUFFER_SIZE);
+	AN(font->buffer);
+	font->runs = calloc(FONT_RUN_CACHE_SIZE, sizeof(*font->runs));
+	AN(font->runs);
+}
+
+// runs drawn since the previous call may be evicted again; their pixels
+// are only read when the frame is rasterized
+static void font_begin_frame(struct font* font)
+{
+	font->frame++;
+}
+
+static void font_set_color(struct font* font, uint32_t color)
+{
+	font->color = color;
+}
+
+static void font_set_cursor(struct font* font, int x, int y)
+{
+	font->x0 = x;
+	font->x = x;
+	font->y = y;
+}
+
+// advances the cursor over text, drawing glyph by glyph if screen is set
+static void font_layout(struct font* font, struct screen* screen, const char* text, int n)
+{
+	for (int i = 0; i < n; i++) {
+		unsigned char ch = text[i];
 		if (ch == '\n') {
 			font->x = font->x0;
 			font->y += 9;
 			continue;
 		}
-		int x0 = (ch & 15) * 6;
-		int y0 = (ch >> 4) * 6;
-		screen_draw_img_color(screen, &font->img, x0, y0, font->x, font->y, 6, 6, font->color);
+		if (screen != NULL) {
+			int x0 = (ch & 15) * 6;
+			int y0 = (ch >> 4) * 6;
+			screen_draw_img_color(screen, &font->img, x0, y0, font->x, font->y, 6, 6, font->color);
+		}
 		font->x += 6;
 	}
+}
+
+static void font_run_rasterize(struct font* font, struct font_run* run, const char* text, int n)
+{
+	int w = 0;
+	int h = 0;
+	int x = run->dx;
+	int y = 0;
+	for (int i = 0; i < n; i++) {
+		if (text[i] == '\n') {
+			x = 0;
+			y += 9;
+			continue;
+		}
+		x += 6;
+		if (x > w) w = x;
+		if (y + 6 > h) h = y + 6;
+	}
+
+	if (w * h > run->capacity) {
+		run->capacity = w * h;
+		run->img.data = realloc(run->img.data, run->capacity * sizeof(uint32_t));
+		AN(run->img.data);
+	}
+	run->img.width = w;
+	run->img.height = h;
+	img_fill_rect(&run->img, 0, 0, w, h, 0xff00ff); // color key
+
+	x = run->dx;
+	y = 0;
+	for (int i = 0; i < n; i++) {
+		unsigned char ch = text[i];
+		if (ch == '\n') {
+			x = 0;
+			y += 9;
+			continue;
+		}
+		uint32_t* src = font->img.data + (ch & 15) * 6 + (ch >> 4) * 6 * font->img.width;
+		uint32_t* dst = run->img.data + x + y * w;
+		for (int gy = 0; gy < 6; gy++) {
+			for (int gx = 0; gx < 6; gx++) {
+				if ((src[gx] & 0xffffff) != 0xff00ff) dst[gx] = run->color;
+			}
+			src += font->img.width;
+			dst += w;
+		}
+		x += 6;
+	}
+
+	// drawn through the same span path as sprites
+	img_build_spans(&run->img);
+}
+
+// NULL if every candidate slot is already drawn this frame
+static struct font_run* font_get_run(struct font* font, const char* text, int n)
+{
+	int dx = font->x - font->x0;
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < n; i++) hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+	hash = (hash ^ font->color) * 16777619u;
+	hash = (hash ^ (uint32_t)dx) * 16777619u;
+
+	struct font_run* victim = NULL;
+	for (int probe = 0; probe < FONT_RUN_PROBES; probe++) {
+		struct font_run* run = &font->runs[(hash + probe) & (FONT_RUN_CACHE_SIZE-1)];
+		if (run->text != NULL && run->hash == hash && run->color == font->color && run->dx == dx && strcmp(run->text, text) == 0) {
+			run->frame = font->frame;
+			return run;
+		}
+		if (victim == NULL || run->text == NULL || (victim->text != NULL && run->frame < victim->frame)) {
+			victim = run;
+		}
+	}
+	if (victim->text != NULL && victim->frame == font->frame) return NULL;
+
+	free(victim->text);
+	victim->text = malloc(n + 1);
+	AN(victim->text);
+	memcpy(victim->text, text, n + 1);
+	victim->hash = hash;
+	victim->color = font->color;
+	victim->dx = dx;
+	victim->frame = font->frame;
+	font_run_rasterize(font, victim, text, n);
+	return victim;
+}
+
+void font_printf(struct font* font, struct screen* screen, const char* fmt, ...) __attribute__((format (printf, 3, 4)));
+void font_printf(struct font* font, struct screen* screen, const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(font->buffer, FONT_BUFFER_SIZE, fmt, args);
 	va_end(args);
+	if (n < 0) return;
+	if (n >= FONT_BUFFER_SIZE) n = FONT_BUFFER_SIZE - 1;
+
+	struct font_run* run = font_get_run(font, font->buffer, n);
+	if (run == NULL) {
+		font_layout(font, screen, font->buffer, n);
+		return;
+	}
+	screen_draw_img(screen, &run->img, 0, 0, font->x0, font->y, run->img.width, run->img.height);
+	font_layout(font, NULL, font->buffer, n);
 }
 
 
+// frame profiler; scopes accumulate per frame and are compiled out
+// entirely with -DNO_PROFILER
+enum prof_scope {
+	PROF_FRAME = 0,
+	PROF_INPUT,
+	PROF_AUDIO_LOCK,
+	PROF_PIANO_ROLL,
+	PROF_ZOMBIES,
+	PROF_DRUMMER,
+	PROF_PLAYERS,
+	PROF_GIBLETS,
+	PROF_RENDER_GROUND,
+	PROF_RENDER_ACTORS,
+	PROF_RENDER_PIANO_ROLL,
+	PROF_RENDER_ZOMBIES,
+	PROF_RASTERIZE,
+	PROF_PRESENT,
+	PROF_MAX
+};
+
+#ifndef NO_PROFILER
+static const char* prof_scope_names[PROF_MAX] = {
+	"total",
+	"input",
+	"audio lock",
+	"piano roll",
+	"zombies",
+	"drummer",
+	"players",
+	"giblets",
+	"r ground",
+	"r actors",
+	"r piano roll",
+	"r zombies",
+	"rasterize",
+	"present",
+};
+
+#define PROF_HISTORY (128)
+// one column per scope, then the rasterizer's pixel visits and the
+// number of live giblets
+#define PROF_PIXELS (PROF_MAX)
+#define PROF_LIVE_GIBLETS (PROF_MAX + 1)
+#define PROF_COLUMNS (PROF_MAX + 2)
+
+struct profiler {
+	int overlay;
+	struct trace_buffer* trace; // scopes also go on the timeline when set
+	uint64_t begin[PROF_MAX];
+	uint64_t ticks[PROF_MAX];
+	double ms_per_tick;
+
+	// PROF_COLUMNS per frame; the last PROF_HISTORY frames in a ring,
+	// or every frame when keep_all is set (for the csv)
+	int keep_all;
+	float* samples;
+	int n_frames;
+	int max_frames;
+};
+
+static void profiler_init(struct profiler* p, int keep_all)
+{
+	memset(p, 0, sizeof(*p));
+	p->ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	p->keep_all = keep_all;
+	p->max_frames = PROF_HISTORY;
+	p->samples = calloc(p->max_frames * PROF_COLUMNS, sizeof(*p->samples));
+	AN(p->samples);
+}
+
+static inline void profiler_begin(struct profiler* p, enum prof_scope scope)
+{
+	TRACE_BEGIN(p->trace, prof_scope_names[scope]);
+	p->begin[scope] = SDL_GetPerformanceCounter();
+}
+
+static inline void profiler_end(struct profiler* p, enum prof_scope scope)
+{
+	p->ticks[scope] += SDL_GetPerformanceCounter() - p->begin[scope];
+	TRACE_END(p->trace, prof_scope_names[scope]);
+}
+
+static float* profiler_row(struct profiler* p, int frame)
+{
+	return &p->samples[(frame % p->max_frames) * PROF_COLUMNS];
+}
+
+static void profiler_end_frame(struct profiler* p, int pixel_visits, int n_giblets)
+{
+	if (p->keep_all && p->n_frames == p->max_frames) {
+		p->max_frames *= 2;
+		p->samples = realloc(p->samples, p->max_frames * PROF_COLUMNS * sizeof(*p->samples));
+		AN(p->samples);
+	}
+	float* row = profiler_row(p, p->n_frames);
+	for (int i = 0; i < PROF_MAX; i++) {
+		row[i] = (float)((double)p->ticks[i] * p->ms_per_tick);
+		p->ticks[i] = 0;
+	}
+	row[PROF_PIXELS] = (float)pixel_visits;
+	row[PROF_LIVE_GIBLETS] = (float)n_giblets;
+	p->n_frames++;
+}
+
+static int profiler_float_cmp(const void* va, const void* vb)
+{
+	float a = *(const float*)va;
+	float b = *(const float*)vb;
+	return (a > b) - (a < b);
+}
+
+static uint32_t profiler_scope_color(int scope)
+{
+	const uint32_t colors[] = {
+		mkcol(96,96,96),
+		mkcol(255,255,255),
+		mkcol(255,64,255),
+		mkcol(254,200,69),
+		mkcol(120,200,60),
+		mkcol(225,32,6),
+		mkcol(251,130,114),
+		mkcol(200,0,0),
+		mkcol(80,80,200),
+		mkcol(110,206,237),
+		mkcol(255,160,0),
+		mkcol(60,140,60),
+		mkcol(0,120,255),
+		mkcol(190,190,190),
+	};
+	return colors[scope];
+}
+
+// stacked per-scope graph of the last PROF_HISTORY frames, plus mean,
+// median and 99th percentile per scope
+static void profiler_render(struct profiler* p, struct screen* screen, struct font* font)
+{
+	int n = p->n_frames < PROF_HISTORY ? p->n_frames : PROF_HISTORY;
+	if (n == 0) return;
+
+	int graph_h = 48;
+	float graph_ms = 1000.0f / (float)SIM_HZ * 2.0f; // full height: two sim steps
+	int gx0 = SCREEN_WIDTH - PROF_HISTORY - 2;
+	int gy1 = SCREEN_HEIGHT - 2;
+	screen_draw_rect(screen, gx0, gy1 - graph_h, PROF_HISTORY, graph_h, 0);
+	for (int i = 0; i < n; i++) {
+		float* row = profiler_row(p, p->n_frames - n + i);
+		int x = gx0 + PROF_HISTORY - n + i;
+		float acc = 0;
+		int y = gy1;
+		for (int scope = PROF_FRAME + 1; scope <= PROF_MAX; scope++) {
+			// whatever the frame spent outside any scope goes on top
+			acc = scope < PROF_MAX ? acc + row[scope] : row[PROF_FRAME];
+			int top = gy1 - (int)(acc * (float)graph_h / graph_ms);
+			if (top < gy1 - graph_h) top = gy1 - graph_h;
+			if (top >= y) continue;
+			screen_draw_rect(screen, x, top, 1, y - top, profiler_scope_color(scope < PROF_MAX ? scope : PROF_FRAME));
+			y = top;
+		}
+	}
+	screen_draw_rect(screen, gx0, gy1 - graph_h / 2, PROF_HISTORY, 1, mkcol(255,255,255));
+
+	float sorted[PROF_HISTORY];
+	screen_draw_rect(screen, 0, 0, 34 * 6 + 4, PROF_MAX * 9 + 31, 0);
+	font_set_cursor(font, 2, 2);
+	font_set_color(font, mkcol(255,255,255));
+	font_printf(font, screen, "%-14s%6s%6s%6s\n", "ms", "mean", "p50", "p99");
+	for (int scope = 0; scope < PROF_MAX; scope++) {
+		float sum = 0;
+		for (int i = 0; i < n; i++) {
+			sorted[i] = profiler_row(p, p->n_frames - n + i)[scope];
+			sum += sorted[i];
+		}
+		qsort(sorted, n, sizeof(*sorted), profiler_float_cmp);
+		font_set_color(font, profiler_scope_color(scope));
+		font_printf(font, screen, "%-14s%6.2f%6.2f%6.2f\n",
+			prof_scope_names[scope],
+			sum / (float)n,
+			sorted[n / 2],
+			sorted[(n * 99) / 100]);
+	}
+	font_set_color(font, mkcol(255,255,255));
+	float* last = profiler_row(p, p->n_frames - 1);
+	float peak = 0;
+	for (int i = 0; i < n; i++) {
+		float v = profiler_row(p, p->n_frames - n + i)[PROF_LIVE_GIBLETS];
+		if (v > peak) peak = v;
+	}
+	font_printf(font, screen, "%-14s%d\n", "px visited", (int)last[PROF_PIXELS]);
+	font_printf(font, screen, "%-14s%d (peak %d)\n", "live giblets", (int)last[PROF_LIVE_GIBLETS], (int)peak);
+}
+
+static void profiler_write_csv(struct profiler* p, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: could not write profile\n", path);
+		return;
+	}
+	int first = p->n_frames > p->max_frames ? p->n_frames - p->max_frames : 0;
+	fprintf(f, "frame");
+	for (int scope = 0; scope < PROF_MAX; scope++) fprintf(f, ",%s", prof_scope_names[scope]);
+	fprintf(f, ",pixels visited,live giblets\n");
+	for (int frame = first; frame < p->n_frames; frame++) {
+		float* row = profiler_row(p, frame);
+		fprintf(f, "%d", frame);
+		for (int scope = 0; scope < PROF_MAX; scope++) fprintf(f, ",%.4f", row[scope]);
+		fprintf(f, ",%d,%d\n", (int)row[PROF_PIXELS], (int)row[PROF_LIVE_GIBLETS]);
+	}
+	fclose(f);
+}
+
+#define PROF_BEGIN(p, scope) profiler_begin(p, scope)
+#define PROF_END(p, scope) profiler_end(p, scope)
+
+#else
+
+// only what main touches is left; the overlay and the csv are gone too
+struct profiler {
+	int overlay;
+	struct trace_buffer* trace;
+};
+
+static inline void profiler_init(struct profiler* p, int keep_all)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+static inline void profiler_end_frame(struct profiler* p, int pixel_visits, int n_giblets)
+{
+}
+
+static inline void profiler_render(struct profiler* p, struct screen* screen, struct font* font)
+{
+}
+
+static inline void profiler_write_csv(struct profiler* p, const char* path)
+{
+	fprintf(stderr, "%s: built with NO_PROFILER, no profile written\n", path);
+}
+
+#define PROF_BEGIN(p, scope)
+#define PROF_END(p, scope)
+
+#endif
+
+
 static uint32_t drum_color(int drum_id)
 {
 	switch (drum_id) {
@@ -746,35 +2203,44 @@ static uint32_t drum_color_dim(int  drum_id)
 }
 
 
-static void piano_roll_render(struct piano_roll* piano_roll, uint32_t* screen, struct font* font)
+static void piano_roll_render_lanes(struct piano_roll* p)
 {
-	float width_in_seconds = 5.0f;
-	float offset_in_seconds = 1.05f;
-
-	float bps = piano_roll->song->bpm / 60.0;
-
-	float width_in_beats = width_in_seconds * bps;
-	float offset_in_beats = offset_in_seconds * bps;
-
-	float current_beat = piano_roll->time_in_seconds * bps;
+	float bps = p->song->bpm / 60.0;
+	float width_in_beats = PIANO_ROLL_WIDTH_IN_SECONDS * bps;
+	float offset_in_beats = PIANO_ROLL_OFFSET_IN_SECONDS * bps;
+	float beat_width = SCREEN_WIDTH / width_in_beats;
+	float step_width = beat_width / p->song->lpb;
+
+	// from the first beat visible at time zero until the last step has
+	// scrolled out of view
+	int song_beats = (p->song->length + p->song->lpb - 1) / p->song->lpb;
+	int b0 = (int)floorf(-offset_in_beats) - 1;
+	int b1 = song_beats + (int)ceilf(width_in_beats) + 1;
+	p->lanes_first_beat = b0;
+
+	struct img* img = &p->lanes;
+	img->width = (int)ceilf((float)(b1 - b0) * beat_width);
+	img->height = PIANO_ROLL_LANES_HEIGHT;
+	img->bpp = 4;
+	img->data = malloc(img->width * img->height * sizeof(uint32_t));
+	AN(img->data);
+	img_fill_rect(img, 0, 0, img->width, img->height, 0xff00ff); // color key
 
-	float x0 = (SCREEN_WIDTH * offset_in_seconds) / width_in_seconds;
+	// everything below is in screen rows, offset by PIANO_ROLL_LANES_Y
+	int oy = -PIANO_ROLL_LANES_Y;
 
-	// render bars
-	int b0 = (int)floorf(current_beat - offset_in_beats);
-	int b1 = b0 + (int)ceilf(width_in_beats) + 1;
-	float beat_width = SCREEN_WIDTH / width_in_beats;
+	// bars
 	for (int b = b0; b <= b1; b++) {
 		for (int sub = 0; sub < 4; sub++) {
 			if (sub&1) continue;
 			float bf = (float)b + (float)sub * 0.25f;
 
-			float x = x0 + (bf - current_beat) * beat_width;
+			float x = (bf - (float)b0) * beat_width;
 
 			int width = 0;
 			int th = 0;
 			if (sub == 0) {
-				if ((b % piano_roll->song->time_signature) == 0) {
+				if ((b % p->song->time_signature) == 0) {
 					width = 3;
 					th = 7;
 				} else {
@@ -786,233 +2252,1378 @@ static void piano_roll_render(struct piano_roll* piano_roll, uint32_t* screen, s
 				th = 1;
 			}
 
+			for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
+				uint32_t color = 0;
+				if (sub == 0) {
+					color = drum_color_overlay(drum_id);
+				} else {
+					color = drum_color_dim(drum_id);
+				}
+				img_fill_rect(img, (int)x-width/2-1, oy + 17 + drum_id*9, width, 7, color);
+			}
+
+			img_fill_rect(img, (int)x-width/2-1, oy + 8 + 7-th, width, th, mkcol(255,255,255));
+			img_fill_rect(img, (int)x-width/2-1, oy + 53, width, th, mkcol(255,255,255));
+		}
+	}
+
+	int spacing = 9;
+	int y0 = 16;
+
+	// song
+	for (int s = 0; s < p->song->length; s++) {
+		float x = ((float)s - (float)(b0 * p->song->lpb)) * step_width;
+		int dctl = p->song->drums[s];
+
+		for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
+			int mask = 1<<drum_id;
+			if (!(dctl & mask)) continue;
+			img_fill_rect(img, (int)x-2-1, oy + y0+drum_id*spacing+2-1, 7, 7, 0);
+			img_fill_rect(img, (int)x-2, oy + y0+drum_id*spacing+2, 5, 5, drum_color_light(drum_id));
+		}
+	}
+
+	img_build_spans(img);
+}
+
+static void piano_roll_render(struct piano_roll* piano_roll, struct screen* screen, struct font* font)
+{
+	float bps = piano_roll->song->bpm / 60.0;
+
+	float width_in_beats = PIANO_ROLL_WIDTH_IN_SECONDS * bps;
+	float current_beat = piano_roll->time_in_seconds * bps;
+	float beat_width = SCREEN_WIDTH / width_in_beats;
+
+	float x0 = (SCREEN_WIDTH * PIANO_ROLL_OFFSET_IN_SECONDS) / PIANO_ROLL_WIDTH_IN_SECONDS;
+
+	// scroll the pre-rendered lanes; they stop at the end of the strip
+	{
+		struct img* lanes = &piano_roll->lanes;
+		int src_x = (int)((current_beat - (float)piano_roll->lanes_first_beat) * beat_width - x0);
+		int dst_x = 0;
+		int w = SCREEN_WIDTH;
+		if (src_x > lanes->width - w) src_x = lanes->width - w;
+		if (src_x < 0) {
+			dst_x = -src_x;
+			w += src_x;
+			src_x = 0;
+		}
+		screen_draw_img(screen, lanes, src_x, 0, dst_x, PIANO_ROLL_LANES_Y, w, lanes->height);
+	}
+
+	int spacing = 9;
+	int y0 = 16;
+
+	// render played notes
+	float second_width = (float)SCREEN_WIDTH / PIANO_ROLL_WIDTH_IN_SECONDS;
+	for (int i = 0; i < MAX_PLAYED_NOTES; i++) {
+		struct played_note* note = &piano_roll->played_notes[i];
+		if (note->time_in_seconds <= 0.0) continue;
+		float dt = note->time_in_seconds - piano_roll->time_in_seconds;
+		float x = x0 + dt * second_width;
+		//screen_draw_rect(screen, (int)x-2, y0+note->drum_id*spacing+2, 5, 5, drum_color(note->drum_id));
+		screen_draw_rect(screen, (int)x-5/2, y0+note->drum_id*spacing, 3, 2, drum_color(note->drum_id));
+		screen_draw_rect(screen, (int)x-5/2, y0+note->drum_id*spacing+7, 3, 2, drum_color(note->drum_id));
+	}
+
+	// render gauge
+	{
+		int dx = piano_roll->gauge * SCREEN_WIDTH;
+		if (dx < 0) dx = 0;
+		if (dx >= SCREEN_WIDTH) dx = SCREEN_WIDTH;
+		int green = piano_roll->gauge * 255;
+		if (green < 0) green = 0;
+		if (green > 255) green = 255;
+		int red = 255 - piano_roll->gauge * 255;
+		if (red < 0) red = 0;
+		if (red > 255) red = 255;
+		screen_draw_rect(screen, 0, 201, dx, 7, mkcol(red,green,0));
+
+		font_set_color(font, 0);
+		font_set_cursor(font, 1, 202);
+		font_printf(font, screen, "awesomemeter");
+	}
+}
+
+/*
+   where the framebuffer goes in the window. recomputing it means asking SDL
+   about the output size, so it's cached and only invalidated by window and
+   display events (resize, move to another display, DPI change, ...)
+*/
+struct present_layout {
+	int valid;
+	int integer_scale;
+	int clear_frames; // back buffers left to clear after a layout change
+	SDL_Rect rect;
+};
+
+static void present_layout_invalidate(struct present_layout* layout)
+{
+	layout->valid = 0;
+}
+
+/*
+   zero-copy presentation renders straight into the locked streaming texture
+   instead of uploading a copy with SDL_UpdateTexture(). it's only worth it
+   if the driver hands back the same, readable memory every time, which is
+   what anything restoring or reusing last frame's pixels depends on, so
+   probe for that and fall back to copying otherwise
+*/
+static int texture_lock_retains_pixels(SDL_Texture* texture)
+{
+	void* pixels;
+	int pitch;
+	int n = 64;
+
+	if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0) return 0;
+	for (int i = 0; i < n; i++) ((uint32_t*)pixels)[i] = 0x5a0000 + i;
+	SDL_UnlockTexture(texture);
+
+	if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0) return 0;
+	int retained = 1;
+	for (int i = 0; i < n; i++) {
+		if (((uint32_t*)pixels)[i] != 0x5a0000 + i) retained = 0;
+	}
+	SDL_UnlockTexture(texture);
+
+	return retained;
+}
+
+// only events that can change the output size or the display under us;
+// focus, enter/leave and the like keep the layout
+static int present_layout_event(SDL_Event* e)
+{
+	if (e->type == SDL_WINDOWEVENT) {
+		switch (e->window.event) {
+			case SDL_WINDOWEVENT_SIZE_CHANGED:
+			case SDL_WINDOWEVENT_RESIZED:
+			case SDL_WINDOWEVENT_MOVED:
+			#if SDL_VERSION_ATLEAST(2,0,18)
+			case SDL_WINDOWEVENT_DISPLAY_CHANGED:
+			#endif
+				return 1;
+		}
+		return 0;
+	}
+	#if SDL_VERSION_ATLEAST(2,0,9)
+	if (e->type == SDL_DISPLAYEVENT) return 1;
+	#endif
+	return 0;
+}
+
+static void present_layout_update(struct present_layout* layout, SDL_Renderer* renderer)
+{
+	// output size is in pixels, which is what we want on HiDPI displays
+	int window_width, window_height;
+	SAZ(SDL_GetRendererOutputSize(renderer, &window_width, &window_height));
+
+	// minimized, or caught mid-resize: keep the old layout and try again
+	// next frame
+	if (window_width <= 0 || window_height <= 0) return;
+
+	float window_aspect = (float)window_width / (float)window_height;
+	float screen_aspect = (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT;
+
+	SDL_Rect rect;
+
+	int scale = 0;
+	if (layout->integer_scale) {
+		int sx = window_width / SCREEN_WIDTH;
+		int sy = window_height / SCREEN_HEIGHT;
+		scale = sx < sy ? sx : sy;
+	}
+
+	if (scale > 0) {
+		rect.w = SCREEN_WIDTH * scale;
+		rect.h = SCREEN_HEIGHT * scale;
+		rect.x = (window_width - rect.w) / 2;
+		rect.y = (window_height - rect.h) / 2;
+	} else if (screen_aspect > window_aspect) {
+		rect.w = window_width;
+		rect.h = (window_width * SCREEN_HEIGHT) / SCREEN_WIDTH;
+		rect.x = 0;
+		rect.y = (window_height - rect.h) / 2;
+	} else {
+		rect.w = (window_height * SCREEN_WIDTH) / SCREEN_HEIGHT;
+		rect.h = window_height;
+		rect.x = (window_width - rect.w) / 2;
+		rect.y = 0;
+	}
+
+	ASSERT(rect.w > 0);
+	ASSERT(rect.h > 0);
+	ASSERT(rect.x >= 0);
+	ASSERT(rect.y >= 0);
+
+	layout->rect = rect;
+	layout->valid = 1;
+	layout->clear_frames = 2;
+}
+
+static void present_screen(SDL_Renderer* renderer, SDL_Texture* texture, struct present_layout* layout)
+{
+	if (!layout->valid) present_layout_update(layout, renderer);
+
+	// letterbox bars aren't drawn; wipe whatever the old layout left there
+	if (layout->clear_frames > 0) {
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+		SDL_RenderClear(renderer);
+		layout->clear_frames--;
+	}
+
+	// nothing to copy to before the first usable output size
+	if (layout->rect.w > 0) SDL_RenderCopy(renderer, texture, NULL, &layout->rect);
+
+	SDL_RenderPresent(renderer);
+}
+
+
+/*
+   CPU integer upscaler. SDL's software renderer scales with a generic
+   stretch blit that's slow at 1080p and up, so when we're stuck with it we
+   do nearest-neighbour integer scaling ourselves: every source row is
+   widened once, then replicated with memcpy() into a streaming texture of
+   exactly the output size, which SDL then only has to copy 1:1
+*/
+
+#define CPU_UPSCALE_MIN (2)
+#define CPU_UPSCALE_MAX (10)
+
+struct cpu_upscaler {
+	int scale; // 0: not scaling, let SDL do it
+	int width; // source size
+	int height;
+	SDL_Texture* texture;
+
+	// per upload
+	uint32_t* src;
+	int src_pitch;
+	uint32_t* dst;
+	int dst_pitch;
+};
+
+static inline void upscale_row(uint32_t* dst, uint32_t* src, int width, int scale)
+{
+	#ifdef __SSE2__
+	if (scale == 2 || scale == 4) {
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			__m128i v = _mm_loadu_si128((__m128i*)(src + x));
+			if (scale == 2) {
+				_mm_storeu_si128((__m128i*)(dst + x*2), _mm_unpacklo_epi32(v, v));
+				_mm_storeu_si128((__m128i*)(dst + x*2 + 4), _mm_unpackhi_epi32(v, v));
+			} else {
+				_mm_storeu_si128((__m128i*)(dst + x*4), _mm_shuffle_epi32(v, 0x00));
+				_mm_storeu_si128((__m128i*)(dst + x*4 + 4), _mm_shuffle_epi32(v, 0x55));
+				_mm_storeu_si128((__m128i*)(dst + x*4 + 8), _mm_shuffle_epi32(v, 0xaa));
+				_mm_storeu_si128((__m128i*)(dst + x*4 + 12), _mm_shuffle_epi32(v, 0xff));
+			}
+		}
+		for (; x < width; x++) {
+			for (int i = 0; i < scale; i++) dst[x*scale + i] = src[x];
+		}
+		return;
+	}
+	#endif
+	for (int x = 0; x < width; x++) {
+		uint32_t c = src[x];
+		for (int i = 0; i < scale; i++) *(dst++) = c;
+	}
+}
+
+static void cpu_upscaler_band(void* userdata, int band, int n_bands)
+{
+	struct cpu_upscaler* up = userdata;
+	int y0 = (band * up->height) / n_bands;
+	int y1 = ((band + 1) * up->height) / n_bands;
+	int scale = up->scale;
+	size_t row_size = up->width * scale * sizeof(uint32_t);
+	for (int y = y0; y < y1; y++) {
+		uint32_t* src = up->src + y * up->src_pitch;
+		uint32_t* dst = up->dst + y * scale * up->dst_pitch;
+		// constant scales so the inlined row loop gets specialized
+		switch (scale) {
+		case 2: upscale_row(dst, src, up->width, 2); break;
+		case 3: upscale_row(dst, src, up->width, 3); break;
+		case 4: upscale_row(dst, src, up->width, 4); break;
+		case 5: upscale_row(dst, src, up->width, 5); break;
+		case 6: upscale_row(dst, src, up->width, 6); break;
+		default: upscale_row(dst, src, up->width, scale); break;
+		}
+		for (int i = 1; i < scale; i++) {
+			memcpy(dst + i * up->dst_pitch, dst, row_size);
+		}
+	}
+}
+
+// pick a scale for the (integer scaled) layout, (re)creating the texture
+static void cpu_upscaler_fit(struct cpu_upscaler* up, SDL_Renderer* renderer, struct present_layout* layout, struct screen* screen)
+{
+	up->width = SCREEN_WIDTH * screen->scale;
+	up->height = SCREEN_HEIGHT * screen->scale;
+	int scale = layout->rect.w / up->width;
+	if (scale < CPU_UPSCALE_MIN) scale = 0;
+	if (scale > CPU_UPSCALE_MAX) scale = CPU_UPSCALE_MAX;
+	if (scale == up->scale) return;
+
+	if (up->texture) SDL_DestroyTexture(up->texture);
+	up->texture = NULL;
+	up->scale = scale;
+	if (scale == 0) return;
+
+	up->texture = SDL_CreateTexture(
+			renderer,
+			SDL_PIXELFORMAT_ABGR8888,
+			SDL_TEXTUREACCESS_STREAMING,
+			up->width * scale,
+			up->height * scale);
+	SAN(up->texture);
+}
+
+// upload the screen, upscaled if possible; returns the texture to present
+static SDL_Texture* cpu_upscaler_upload(struct cpu_upscaler* up, struct screen* screen, SDL_Texture* texture)
+{
+	if (up->scale == 0) {
+		SDL_UpdateTexture(texture, NULL, screen->pixels, screen->pitch * sizeof(uint32_t));
+		return texture;
+	}
+
+	void* pixels;
+	int pitch;
+	SAZ(SDL_LockTexture(up->texture, NULL, &pixels, &pitch));
+	up->src = screen->pixels;
+	up->src_pitch = screen->pitch;
+	up->dst = pixels;
+	up->dst_pitch = pitch / sizeof(uint32_t);
+	render_pool_run(screen->pool, cpu_upscaler_band, up);
+	SDL_UnlockTexture(up->texture);
+	return up->texture;
+}
+
+static void bench_upscale(struct render_pool* pool)
+{
+	struct img src_img;
+	img_load(&src_img, "background.png");
+	ASSERT(src_img.width == SCREEN_WIDTH);
+	ASSERT(src_img.height == SCREEN_HEIGHT);
+
+	struct screen screen;
+	screen_init(&screen, 1);
+	memcpy(screen.pixels, src_img.data, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+
+	// 768x432 and 1536x864 are exact 2x/4x fits
+	const int resolutions[][2] = {
+		{768, 432},
+		{1280, 720},
+		{1536, 864},
+		{1920, 1080},
+		{2560, 1440},
+		{3840, 2160},
+	};
+	int n_iterations = 100;
+	double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	printf("upscaling 384x216 through SDL's software renderer, ms/frame:\n");
+	printf("  output      scale   SDL scaler    CPU 1 thread    CPU %d thread(s)\n", pool->n_threads);
+	int n_resolutions = sizeof(resolutions) / sizeof(resolutions[0]);
+	for (int r = 0; r < n_resolutions; r++) {
+		int width = resolutions[r][0];
+		int height = resolutions[r][1];
+
+		SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 32, 0xff, 0xff00, 0xff0000, 0xff000000);
+		SAN(surface);
+		SDL_Renderer* renderer = SDL_CreateSoftwareRenderer(surface);
+		SAN(renderer);
+		SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+		SAN(texture);
+
+		struct present_layout layout;
+		memset(&layout, 0, sizeof(layout));
+		layout.integer_scale = 1;
+		present_layout_update(&layout, renderer);
+
+		struct cpu_upscaler up;
+		memset(&up, 0, sizeof(up));
+		cpu_upscaler_fit(&up, renderer, &layout, &screen);
+
+		double results[3];
+
+		uint64_t t0 = SDL_GetPerformanceCounter();
+		for (int i = 0; i < n_iterations; i++) {
+			SDL_UpdateTexture(texture, NULL, screen.pixels, screen.pitch * sizeof(uint32_t));
+			SDL_RenderCopy(renderer, texture, NULL, &layout.rect);
+		}
+		results[0] = (double)(SDL_GetPerformanceCounter() - t0) * ms / n_iterations;
+
+		for (int j = 0; j < 2; j++) {
+			screen.pool = j == 0 ? NULL : pool;
+			t0 = SDL_GetPerformanceCounter();
+			for (int i = 0; i < n_iterations; i++) {
+				SDL_Texture* t = cpu_upscaler_upload(&up, &screen, texture);
+				SDL_RenderCopy(renderer, t, NULL, &layout.rect);
+			}
+			results[1+j] = (double)(SDL_GetPerformanceCounter() - t0) * ms / n_iterations;
+		}
+
+		printf("  %4dx%-4d   %3dx   %8.3f      %8.3f        %8.3f\n", width, height, layout.rect.w / SCREEN_WIDTH, results[0], results[1], results[2]);
+
+		if (up.texture) SDL_DestroyTexture(up.texture);
+		SDL_DestroyTexture(texture);
+		SDL_DestroyRenderer(renderer);
+		SDL_FreeSurface(surface);
+	}
+
+	img_free(&src_img);
+	screen_free(&screen);
+}
+
+/*
+   headless video backend: no window, no renderer, no present. frames are
+   paced by a scripted clock (see audio_pump()), input comes from a script
+   file, and selected frames are dumped as PNG or compared against
+   previously dumped ones. script lines are "<frame> <key>", where key is a
+   single character or one of return, escape, up, down, left, right, quit
+*/
+
+struct script_event {
+	int frame;
+	int key; // SDL_Keycode, or 0 for quit
+};
+
+struct headless {
+	int enabled;
+	int frame;
+	int max_frames; // 0: run until quit
+	int fps; // scripted clock rate
+	int quit_sent;
+
+	struct script_event* events;
+	int n_events;
+	int next_event;
+
+	int* dump_frames;
+	int n_dump_frames;
+	const char* dump_dir;
+	const char* golden_dir;
+	int golden_failures;
+
+	uint64_t t0;
+	uint64_t raster_ticks;
+};
+
+static int headless_parse_key(const char* name)
+{
+	if (strlen(name) == 1) return (unsigned char)name[0];
+	if (strcmp(name, "return") == 0) return SDLK_RETURN;
+	if (strcmp(name, "escape") == 0) return SDLK_ESCAPE;
+	if (strcmp(name, "up") == 0) return SDLK_UP;
+	if (strcmp(name, "down") == 0) return SDLK_DOWN;
+	if (strcmp(name, "left") == 0) return SDLK_LEFT;
+	if (strcmp(name, "right") == 0) return SDLK_RIGHT;
+	if (strcmp(name, "f3") == 0) return SDLK_F3;
+	if (strcmp(name, "f5") == 0) return SDLK_F5;
+	if (strcmp(name, "quit") == 0) return 0;
+	arghf("unknown script key \"%s\"\n", name);
+}
+
+static void headless_load_script(struct headless* h, const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL) arghf("cannot open script %s\n", path);
+	char line[256];
+	int max_events = 0;
+	int line_number = 0;
+	while (fgets(line, sizeof(line), f)) {
+		int frame;
+		char key[32];
+		line_number++;
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%d %31s", &frame, key) != 2) continue;
+		if (h->n_events >= max_events) {
+			max_events = max_events ? max_events << 1 : 256;
+			h->events = realloc(h->events, max_events * sizeof(*h->events));
+			AN(h->events);
+		}
+		struct script_event* ev = &h->events[h->n_events++];
+		ev->frame = frame;
+		ev->key = headless_parse_key(key);
+		if (h->n_events > 1 && ev->frame < ev[-1].frame) {
+			arghf("%s:%d: frame %d comes before frame %d; scripts must be sorted by frame\n", path, line_number, ev->frame, ev[-1].frame);
+		}
+	}
+	fclose(f);
+}
+
+static void headless_parse_dump_frames(struct headless* h, const char* list)
+{
+	const char* p = list;
+	while (*p) {
+		char* end;
+		long frame = strtol(p, &end, 10);
+		if (end == p) arghf("bad frame list \"%s\"\n", list);
+		h->dump_frames = realloc(h->dump_frames, (h->n_dump_frames + 1) * sizeof(*h->dump_frames));
+		AN(h->dump_frames);
+		h->dump_frames[h->n_dump_frames++] = frame;
+		p = end;
+		if (*p == ',') p++;
+	}
+}
+
+static int headless_poll_event(struct headless* h, SDL_Event* e)
+{
+	memset(e, 0, sizeof(*e));
+	if (h->max_frames && h->frame >= h->max_frames && !h->quit_sent) {
+		h->quit_sent = 1;
+		e->type = SDL_QUIT;
+		return 1;
+	}
+	if (h->next_event >= h->n_events) return 0;
+	struct script_event* ev = &h->events[h->next_event];
+	if (ev->frame > h->frame) return 0;
+	h->next_event++;
+	if (ev->key == 0) {
+		e->type = SDL_QUIT;
+	} else {
+		e->type = SDL_KEYDOWN;
+		e->key.keysym.sym = ev->key;
+	}
+	return 1;
+}
+
+static int poll_event(struct headless* h, SDL_Event* e)
+{
+	if (h->enabled) return headless_poll_event(h, e);
+	return SDL_PollEvent(e);
+}
+
+static uint32_t png_crc(uint32_t crc, const uint8_t* p, size_t n)
+{
+	static uint32_t table[256];
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 255] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void png_put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
 
-			for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
-				uint32_t color = 0;
-				if (sub == 0) {
-					color = drum_color_overlay(drum_id);
-				} else {
-					color = drum_color_dim(drum_id);
-				}
-				screen_draw_rect(screen, (int)x-width/2-1, 17 + drum_id*9, width, 7, color);
-			}
+static void png_write_chunk(FILE* f, const char* type, const uint8_t* data, uint32_t n)
+{
+	uint8_t head[8];
+	png_put32(head, n);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = png_crc(png_crc(0, head + 4, 4), data, n);
+	uint8_t tail[4];
+	png_put32(tail, crc);
+	fwrite(head, 1, 8, f);
+	fwrite(data, 1, n, f);
+	fwrite(tail, 1, 4, f);
+}
 
-			screen_draw_rect(screen, (int)x-width/2-1, 8 + 7-th, width, th, mkcol(255,255,255));
-			screen_draw_rect(screen, (int)x-width/2-1, 53, width, th, mkcol(255,255,255));
+// 8-bit RGB PNG with unfiltered rows in stored (uncompressed) deflate
+// blocks; not small, but exact and without a zlib dependency. stb_image
+// reads it back for golden compares
+static void screen_write_png(struct screen* screen, FILE* f)
+{
+	int width = SCREEN_WIDTH * screen->scale;
+	int height = SCREEN_HEIGHT * screen->scale;
+	size_t raw_size = (size_t)height * (1 + width * 3);
+	size_t n_blocks = (raw_size + 65534) / 65535;
+	uint8_t* raw = malloc(raw_size);
+	AN(raw);
+	uint8_t* idat = malloc(2 + raw_size + n_blocks * 5 + 4);
+	AN(idat);
+
+	uint8_t* r = raw;
+	for (int y = 0; y < height; y++) {
+		uint32_t* src = screen->pixels + y * screen->pitch;
+		*(r++) = 0; // filter: none
+		for (int x = 0; x < width; x++) {
+			*(r++) = src[x] & 255;
+			*(r++) = (src[x] >> 8) & 255;
+			*(r++) = (src[x] >> 16) & 255;
 		}
 	}
 
-	int spacing = 9;
-	int y0 = 16;
-
-	// render song
-	int s0 = (int)floorf((current_beat - offset_in_beats) * piano_roll->song->lpb);
-	int s1 = s0 + (int)ceil(width_in_beats * piano_roll->song->lpb)+1;
-	float step_width = (SCREEN_WIDTH / width_in_beats) / piano_roll->song->lpb;
-	float current_step = current_beat * piano_roll->song->lpb;
-	for (int s = s0; s <= s1; s++) {
-		if (s < 0 || s >= piano_roll->song->length) continue;
-		float x = x0 + ((float)s - current_step) * step_width;
-		int dctl = piano_roll->song->drums[s];
+	uint8_t* d = idat;
+	*(d++) = 0x78; // zlib header: deflate, 32k window, no dictionary
+	*(d++) = 0x01;
+	uint32_t a = 1, b = 0; // adler32
+	for (size_t pos = 0; pos < raw_size; pos += 65535) {
+		uint32_t n = raw_size - pos < 65535 ? raw_size - pos : 65535;
+		*(d++) = pos + n == raw_size; // BFINAL, BTYPE 00
+		*(d++) = n & 255;
+		*(d++) = n >> 8;
+		*(d++) = ~n & 255;
+		*(d++) = (~n >> 8) & 255;
+		memcpy(d, raw + pos, n);
+		d += n;
+		for (uint32_t i = 0; i < n; i++) {
+			a = (a + raw[pos + i]) % 65521;
+			b = (b + a) % 65521;
+		}
+	}
+	png_put32(d, (b << 16) | a);
+	d += 4;
+
+	static const uint8_t signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+	fwrite(signature, 1, 8, f);
+	uint8_t ihdr[13];
+	png_put32(ihdr, width);
+	png_put32(ihdr + 4, height);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = 2; // RGB
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	png_write_chunk(f, "IHDR", ihdr, 13);
+	png_write_chunk(f, "IDAT", idat, d - idat);
+	png_write_chunk(f, "IEND", NULL, 0);
+	free(idat);
+	free(raw);
+}
 
-		for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
-			int mask = 1<<drum_id;
-			if (!(dctl & mask)) continue;
-			// int width =5;
-			//screen_draw_rect(screen, (int)x-width/2, y0+drum_id*spacing, 3, 2, drum_color_light(drum_id));
-			//screen_draw_rect(screen, (int)x-width/2, y0+drum_id*spacing+7, 3, 2, drum_color_light(drum_id));
-			screen_draw_rect(screen, (int)x-2-1, y0+drum_id*spacing+2-1, 7, 7, 0);
-			screen_draw_rect(screen, (int)x-2, y0+drum_id*spacing+2, 5, 5, drum_color_light(drum_id));
+// 1 if the golden image at path exists and matches the screen exactly
+static int screen_matches_png(struct screen* screen, const char* path)
+{
+	int width, height, bpp;
+	uint8_t* golden = stbi_load(path, &width, &height, &bpp, 4);
+	if (golden == NULL) return 0;
+	int same = width == SCREEN_WIDTH * screen->scale && height == SCREEN_HEIGHT * screen->scale;
+	for (int y = 0; same && y < height; y++) {
+		uint32_t* src = screen->pixels + y * screen->pitch;
+		uint8_t* g = golden + y * width * 4;
+		for (int x = 0; x < width; x++) {
+			uint32_t c = g[x*4] | (g[x*4+1] << 8) | (g[x*4+2] << 16);
+			if (c != (src[x] & 0xffffff)) {
+				same = 0;
+				break;
+			}
 		}
 	}
+	stbi_image_free(golden);
+	return same;
+}
 
-	// render played notes
-	float second_width = (float)SCREEN_WIDTH / width_in_seconds;
-	for (int i = 0; i < MAX_PLAYED_NOTES; i++) {
-		struct played_note* note = &piano_roll->played_notes[i];
-		if (note->time_in_seconds <= 0.0) continue;
-		float dt = note->time_in_seconds - piano_roll->time_in_seconds;
-		float x = x0 + dt * second_width;
-		//screen_draw_rect(screen, (int)x-2, y0+note->drum_id*spacing+2, 5, 5, drum_color(note->drum_id));
-		screen_draw_rect(screen, (int)x-5/2, y0+note->drum_id*spacing, 3, 2, drum_color(note->drum_id));
-		screen_draw_rect(screen, (int)x-5/2, y0+note->drum_id*spacing+7, 3, 2, drum_color(note->drum_id));
+static void headless_present(struct headless* h, struct screen* screen)
+{
+	int dump = 0;
+	for (int i = 0; i < h->n_dump_frames; i++) {
+		if (h->dump_frames[i] == h->frame) dump = 1;
 	}
 
-	// render gauge
-	{
-		int dx = piano_roll->gauge * SCREEN_WIDTH;
-		if (dx < 0) dx = 0;
-		if (dx >= SCREEN_WIDTH) dx = SCREEN_WIDTH;
-		int green = piano_roll->gauge * 255;
-		if (green < 0) green = 0;
-		if (green > 255) green = 255;
-		int red = 255 - piano_roll->gauge * 255;
-		if (red < 0) red = 0;
-		if (red > 255) red = 255;
-		screen_draw_rect(screen, 0, 201, dx, 7, mkcol(red,green,0));
+	if (dump && h->dump_dir) {
+		char path[2048];
+		snprintf(path, sizeof(path), "%s/frame_%05d.png", h->dump_dir, h->frame);
+		FILE* f = fopen(path, "wb");
+		if (f == NULL) arghf("cannot write %s\n", path);
+		screen_write_png(screen, f);
+		fclose(f);
+	}
 
-		font_set_color(font, 0);
-		font_set_cursor(font, 1, 202);
-		font_printf(font, screen, "awesomemeter");
+	if (dump && h->golden_dir) {
+		char path[2048];
+		snprintf(path, sizeof(path), "%s/frame_%05d.png", h->golden_dir, h->frame);
+		if (!screen_matches_png(screen, path)) {
+			fprintf(stderr, "frame %d differs from %s\n", h->frame, path);
+			h->golden_failures++;
+		}
 	}
+
+	h->frame++;
 }
 
-static void present_screen(SDL_Window* window, SDL_Renderer* renderer, SDL_Texture* texture, uint32_t* screen)
+static void* replay_reserve(void* p, int n, int* max, size_t size)
 {
-	//SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-	//SDL_RenderClear(renderer);
+	if (n < *max) return p;
+	*max = *max ? *max << 1 : 256;
+	p = realloc(p, *max * size);
+	AN(p);
+	return p;
+}
 
-	SDL_UpdateTexture(texture, NULL, screen, SCREEN_WIDTH * sizeof(uint32_t));
+// start recording a new round
+static void replay_clear(struct replay* r, int audio_buffer_length_exp)
+{
+	r->sample_rate = 0;
+	r->audio_buffer_length_exp = audio_buffer_length_exp;
+	r->end_position = 0;
+	r->n_drums = 0;
+	r->n_skips = 0;
+	r->n_hashes = 0;
+}
 
-	SDL_DisplayMode mode;
-	SDL_GetDesktopDisplayMode(SDL_GetWindowDisplayIndex(window), &mode);
+// start playing back from the top
+static void replay_rewind(struct replay* r)
+{
+	r->next_drum = 0;
+	r->next_skip = 0;
+	r->next_hash = 0;
+	r->hashes_checked = 0;
+	r->hash_failures = 0;
+}
 
-	int window_width = mode.w;
-	int window_height = mode.h;
+static void replay_record_drum_control(struct replay* r, struct drum_control_feedback* fb)
+{
+	r->drums = replay_reserve(r->drums, r->n_drums, &r->max_drums, sizeof(*r->drums));
+	r->drums[r->n_drums++] = *fb;
+}
 
-	float window_aspect = (float)window_width / (float)window_height;
-	float screen_aspect = (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT;
+static void replay_record_skip(struct replay* r, uint64_t tick, uint64_t to_tick)
+{
+	r->skips = replay_reserve(r->skips, r->n_skips, &r->max_skips, sizeof(*r->skips));
+	struct replay_skip* skip = &r->skips[r->n_skips++];
+	skip->tick = tick;
+	skip->to_tick = to_tick;
+}
 
-	SDL_Rect rect;
-	rect.x = 0;
-	rect.y = 0;
-	rect.w = SCREEN_WIDTH;
-	rect.h = SCREEN_HEIGHT;
+// playback: drops the backlog where the recording did; returns 1 if *tick
+// moved
+static int replay_skip(struct replay* r, uint64_t* tick)
+{
+	if (r->next_skip >= r->n_skips || r->skips[r->next_skip].tick != *tick) return 0;
+	*tick = r->skips[r->next_skip++].to_tick;
+	return 1;
+}
 
-	if (screen_aspect > window_aspect) {
-		rect.w = window_width;
-		rect.h = (window_width * SCREEN_HEIGHT) / SCREEN_WIDTH;
-		rect.x = 0;
-		rect.y = (window_height - rect.h) / 2;
-	} else {
-		rect.w = (window_height * SCREEN_WIDTH) / SCREEN_HEIGHT;
-		rect.h = window_height;
-		rect.x = (window_width - rect.w) / 2;
-		rect.y = 0;
-	}
+// playback: continue with the backlog drops from tick on
+static void replay_seek_skips(struct replay* r, uint64_t tick)
+{
+	r->next_skip = 0;
+	while (r->next_skip < r->n_skips && r->skips[r->next_skip].tick < tick) r->next_skip++;
+}
 
-	ASSERT(rect.w > 0);
-	ASSERT(rect.h > 0);
-	ASSERT(rect.x >= 0);
-	ASSERT(rect.y >= 0);
+// records the state hash at the end of a second of song, or checks it
+// against the recorded one
+static void replay_hash_second(struct replay* r, int second, uint64_t hash)
+{
+	if (r->recording) {
+		r->hashes = replay_reserve(r->hashes, r->n_hashes, &r->max_hashes, sizeof(*r->hashes));
+		struct replay_hash* rh = &r->hashes[r->n_hashes++];
+		rh->second = second;
+		rh->hash = hash;
+		return;
+	}
+	while (r->next_hash < r->n_hashes && r->hashes[r->next_hash].second < second) r->next_hash++;
+	if (r->next_hash >= r->n_hashes || r->hashes[r->next_hash].second != second) return;
+	r->hashes_checked++;
+	if (r->hashes[r->next_hash].hash != hash) {
+		if (r->hash_failures == 0) fprintf(stderr, "replay: state differs from the recording at %d s\n", second);
+		r->hash_failures++;
+	}
+}
 
-	SDL_RenderCopy(renderer, texture, NULL, &rect);
+// bump whenever the simulation or game_state_hash() changes; older
+// recordings can't match and are refused instead of failing every hash
+#define REPLAY_VERSION (1)
 
-	SDL_RenderPresent(renderer);
+static void replay_write(struct replay* r, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: could not write replay\n", path);
+		return;
+	}
+	fprintf(f, "# dotd replay\n");
+	fprintf(f, "version %d\n", REPLAY_VERSION);
+	fprintf(f, "rate %u\n", r->sample_rate);
+	fprintf(f, "block %d\n", r->audio_buffer_length_exp);
+	for (int i = 0; i < REPLAY_SEED_MAX; i++) fprintf(f, "seed %s %u\n", replay_seed_names[i], r->seeds[i]);
+	for (int i = 0; i < r->n_drums; i++) fprintf(f, "drum %u %u\n", r->drums[i].position, r->drums[i].value);
+	for (int i = 0; i < r->n_skips; i++) {
+		fprintf(f, "skip %llu %llu\n", (unsigned long long)r->skips[i].tick, (unsigned long long)r->skips[i].to_tick);
+	}
+	for (int i = 0; i < r->n_hashes; i++) {
+		fprintf(f, "hash %d %016llx\n", r->hashes[i].second, (unsigned long long)r->hashes[i].hash);
+	}
+	fprintf(f, "end %u\n", r->end_position);
+	fclose(f);
 }
 
+static void replay_load(struct replay* r, const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL) arghf("cannot open replay %s\n", path);
+	replay_clear(r, 0);
+	unsigned version = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		char name[32];
+		unsigned a;
+		unsigned long long b, c;
+		if (line[0] == '#') continue;
+		if (sscanf(line, "version %u", &a) == 1) {
+			version = a;
+		} else if (sscanf(line, "rate %u", &a) == 1) {
+			r->sample_rate = a;
+		} else if (sscanf(line, "block %u", &a) == 1) {
+			r->audio_buffer_length_exp = a;
+		} else if (sscanf(line, "seed %31s %u", name, &a) == 2) {
+			int i = 0;
+			while (i < REPLAY_SEED_MAX && strcmp(name, replay_seed_names[i]) != 0) i++;
+			if (i == REPLAY_SEED_MAX) arghf("unknown replay seed \"%s\"\n", name);
+			r->seeds[i] = a;
+		} else if (sscanf(line, "drum %u %llu", &a, &b) == 2) {
+			struct drum_control_feedback fb;
+			fb.position = a;
+			fb.value = b;
+			replay_record_drum_control(r, &fb);
+		} else if (sscanf(line, "skip %llu %llu", &b, &c) == 2) {
+			replay_record_skip(r, b, c);
+		} else if (sscanf(line, "hash %u %llx", &a, &b) == 2) {
+			r->hashes = replay_reserve(r->hashes, r->n_hashes, &r->max_hashes, sizeof(*r->hashes));
+			r->hashes[r->n_hashes].second = a;
+			r->hashes[r->n_hashes].hash = b;
+			r->n_hashes++;
+		} else if (sscanf(line, "end %u", &a) == 1) {
+			r->end_position = a;
+		}
+	}
+	fclose(f);
+	if (r->sample_rate == 0) arghf("%s: not a replay\n", path);
+	if (version != REPLAY_VERSION) arghf("%s: replay version %u, this build reads %d\n", path, version, REPLAY_VERSION);
+	r->playing = 1;
+}
 
+#ifndef MAX_GIBLETS
 #define MAX_GIBLETS (512)
+#endif
 
-struct giblet {
-	int type;
+// giblets per physics job
+#define GIBLET_JOB_SIZE (8192)
+
+#define GIBLET_RNG_SEED (666)
+
+// owners with live giblets are kept in an open addressing table that
+// counts their giblets as they bang, land and get evicted; for rendering,
+// each bucket also heads an intrusive list of the owner's giblets
+struct giblet_owner_bucket {
 	int owner;
-	float x;
-	float y;
-	float vx;
-	float vy;
-	int active;
-	int grounded;
+	int count; // live giblets; 0: empty bucket
+	int first; // render list, see giblet_exploder_index_owners()
 };
 
+// what bang does with the oldest giblets when the pool is full
+enum giblet_overflow {
+	GIBLET_OVERFLOW_SPILL = 0, // stamp them into the ground where they'd land
+	GIBLET_OVERFLOW_DROP,      // just forget them
+};
 
+// giblets are kept as structure of arrays, with the n_giblets live ones
+// packed at the front, so physics runs over contiguous floats four at a
+// time; every slot past n_giblets is free. new giblets are appended, and
+// removing one moves the last live giblet into its slot
 struct giblet_exploder {
 	struct img img;
 
+	// the background with every landed giblet stamped into it; landed
+	// giblets free their slot, so gore piles up at no per-frame cost
+	struct img* background;
+	struct img ground;
+
+	int max_giblets;
+	enum giblet_overflow overflow;
+
 	// state
-	int next_giblet;
-	struct giblet* giblets;
+	int n_giblets;
+	int peak_giblets; // most live at once since init, across resets
+	int n_overflowed; // giblets evicted by bang since init
+	int next_giblet; // ring position, seeds the landing height
+	int evict_cursor; // where bang evicts next when the pool is full
+	float* x;
+	float* y;
+	float* prev_x; // position at the previous simulation step
+	float* prev_y;
+	float* vx;
+	float* vy;
+	float* floor_y; // lands when y goes below this
+	int* type;
+	int* owner;
+	int* next_owned; // next giblet with the same owner, or -1
 	struct rng rng;
+
+	// scratch: giblets that landed during an update; each physics job
+	// lists its own at the start of its chunk and counts them in
+	// job_landed, then they're gathered in chunk order
+	int* landed;
+	struct job_count* job_landed;
+
+	struct render_pool* pool; // runs physics jobs, if set
+
+	// render interpolation between prev_* and current position, [0;1)
+	float alpha;
+
+	struct giblet_owner_bucket* owner_buckets;
+	uint32_t owner_bucket_mask;
+	int owner_index_dirty;
 };
 
-static void giblet_exploder_init(struct giblet_exploder* gx)
+static void* giblet_exploder_alloc(int n, size_t size)
+{
+	void* p = calloc(n, size);
+	AN(p);
+	return p;
+}
+
+static void giblet_exploder_init(struct giblet_exploder* gx, struct img* background, int max_giblets)
 {
 	memset(gx, 0, sizeof(*gx));
-	gx->giblets = calloc(MAX_GIBLETS, sizeof(*gx->giblets));
+	gx->background = background;
+	gx->ground = *background;
+	gx->ground.data = malloc(background->width * background->height * sizeof(uint32_t));
+	AN(gx->ground.data);
+	gx->ground.spans = NULL; // stamped into all the time
+	gx->ground.span_rows = NULL;
+	gx->ground.cells = NULL;
+
+	ASSERT(max_giblets > 0);
+	gx->max_giblets = max_giblets;
+	gx->x = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->y = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->prev_x = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->prev_y = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->vx = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->vy = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->floor_y = giblet_exploder_alloc(max_giblets, sizeof(float));
+	gx->type = giblet_exploder_alloc(max_giblets, sizeof(int));
+	gx->owner = giblet_exploder_alloc(max_giblets, sizeof(int));
+	gx->next_owned = giblet_exploder_alloc(max_giblets, sizeof(int));
+	gx->landed = giblet_exploder_alloc(max_giblets, sizeof(int));
+	gx->job_landed = giblet_exploder_alloc((max_giblets + GIBLET_JOB_SIZE - 1) / GIBLET_JOB_SIZE, sizeof(*gx->job_landed));
+
+	uint32_t n_buckets = 1;
+	while (n_buckets < 2 * (uint32_t)max_giblets) n_buckets <<= 1;
+	gx->owner_bucket_mask = n_buckets - 1;
+	gx->owner_buckets = calloc(n_buckets, sizeof(*gx->owner_buckets));
+	AN(gx->owner_buckets);
+	gx->owner_index_dirty = 1;
 	// height:7
 	// number: 8
 	img_load(&gx->img, "gilbets.png");
+	img_set_cells(&gx->img, 12, 7);
+}
+
+static void giblet_exploder_free(struct giblet_exploder* gx)
+{
+	img_free(&gx->img);
+	free(gx->ground.data);
+	free(gx->x);
+	free(gx->y);
+	free(gx->prev_x);
+	free(gx->prev_y);
+	free(gx->vx);
+	free(gx->vy);
+	free(gx->floor_y);
+	free(gx->type);
+	free(gx->owner);
+	free(gx->next_owned);
+	free(gx->landed);
+	free(gx->job_landed);
+	free(gx->owner_buckets);
+	memset(gx, 0, sizeof(*gx));
+}
+
+static uint32_t giblet_exploder_owner_home(struct giblet_exploder* gx, int owner)
+{
+	return ((uint32_t)owner * 2654435761u) & gx->owner_bucket_mask;
+}
+
+static struct giblet_owner_bucket* giblet_exploder_owner_bucket(struct giblet_exploder* gx, int owner, int insert)
+{
+	uint32_t i = giblet_exploder_owner_home(gx, owner);
+	for (;;) {
+		struct giblet_owner_bucket* bucket = &gx->owner_buckets[i];
+		if (bucket->count == 0) {
+			if (!insert) return NULL;
+			bucket->owner = owner;
+			bucket->first = -1;
+			return bucket;
+		}
+		if (bucket->owner == owner) return bucket;
+		i = (i + 1) & gx->owner_bucket_mask;
+	}
+}
+
+static void giblet_exploder_owner_add(struct giblet_exploder* gx, int owner, int n)
+{
+	giblet_exploder_owner_bucket(gx, owner, 1)->count += n;
+}
+
+// one of owner's giblets is gone; the bucket is deleted once it has none,
+// shifting later entries of its probe run back so lookups still find them
+static void giblet_exploder_owner_remove(struct giblet_exploder* gx, int owner)
+{
+	struct giblet_owner_bucket* bucket = giblet_exploder_owner_bucket(gx, owner, 0);
+	AN(bucket);
+	if (--bucket->count > 0) return;
+	uint32_t mask = gx->owner_bucket_mask;
+	uint32_t i = bucket - gx->owner_buckets;
+	uint32_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		struct giblet_owner_bucket* next = &gx->owner_buckets[j];
+		if (next->count == 0) break;
+		// it can fill the hole if the hole lies between its home and j
+		uint32_t home = giblet_exploder_owner_home(gx, next->owner);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			gx->owner_buckets[i] = *next;
+			i = j;
+		}
+	}
+	gx->owner_buckets[i].count = 0;
+}
+
+// empties the owner table by removing every live giblet, so it costs
+// O(n_giblets) rather than a clear of the whole table
+static void giblet_exploder_clear_owners(struct giblet_exploder* gx)
+{
+	for (int i = 0; i < gx->n_giblets; i++) giblet_exploder_owner_remove(gx, gx->owner[i]);
 }
 
 static void giblet_exploder_reset(struct giblet_exploder* gx)
 {
+	giblet_exploder_clear_owners(gx);
+	gx->n_giblets = 0;
 	gx->next_giblet = 0;
-	memset(gx->giblets, 0, sizeof(*gx->giblets) * MAX_GIBLETS);
-	rng_seed(&gx->rng, 666);
+	gx->evict_cursor = 0;
+	rng_seed(&gx->rng, GIBLET_RNG_SEED);
+	gx->alpha = 0;
+	gx->owner_index_dirty = 1;
+	memcpy(gx->ground.data, gx->background->data, gx->ground.width * gx->ground.height * sizeof(uint32_t));
+}
+
+// swap-removes giblet i: the last live giblet takes its slot
+static void giblet_exploder_remove(struct giblet_exploder* gx, int i)
+{
+	int last = --gx->n_giblets;
+	if (i == last) return;
+	gx->x[i] = gx->x[last];
+	gx->y[i] = gx->y[last];
+	gx->prev_x[i] = gx->prev_x[last];
+	gx->prev_y[i] = gx->prev_y[last];
+	gx->vx[i] = gx->vx[last];
+	gx->vy[i] = gx->vy[last];
+	gx->floor_y[i] = gx->floor_y[last];
+	gx->type[i] = gx->type[last];
+	gx->owner[i] = gx->owner[last];
 }
 
 static void giblet_exploder_bang(struct giblet_exploder* gx, int x0, int y0, int w, int h, int owner)
 {
 	int count = 50;
 	float max_speed = 40;
-	for (int i = 0; i < count; i++) {
-		struct giblet* g = &gx->giblets[gx->next_giblet++];
-		if (gx->next_giblet >= MAX_GIBLETS) gx->next_giblet = 0;
+	int base_floor_y = 169;
+
+	// when full, a cursor sweeping the pool picks the giblets that make
+	// room; the newest live at the end and the ones swapped in from there
+	// are passed over, so it's roughly the oldest that go, in O(evict)
+	if (count > gx->max_giblets) count = gx->max_giblets;
+	int evict = gx->n_giblets + count - gx->max_giblets;
+	if (evict > 0) {
+		int c = gx->evict_cursor;
+		if (c + evict > gx->n_giblets) c = 0;
+		for (int i = c; i < c + evict; i++) {
+			if (gx->overflow == GIBLET_OVERFLOW_SPILL) {
+				img_blit(&gx->ground, &gx->img, gx->type[i] * 12, 0, (int)gx->x[i], (int)gx->floor_y[i], 12, 7);
+			}
+			giblet_exploder_owner_remove(gx, gx->owner[i]);
+		}
+		// from the top down, so the giblet swapped in is never one of them
+		for (int i = c + evict - 1; i >= c; i--) giblet_exploder_remove(gx, i);
+		gx->evict_cursor = c + evict;
+		gx->n_overflowed += evict;
+	}
 
-		g->active = 1;
-		g->grounded = 0;
-		g->owner = owner;
-		g->x = (float)x0 + (float)w * rng_float(&gx->rng);
-		g->y = (float)y0 + (float)h * rng_float(&gx->rng);
-		g->vx = (rng_float(&gx->rng) * 2.0 - 1.0) * max_speed;
-		g->vy = (rng_float(&gx->rng) * 2.0 - 1.0) * max_speed;
-		g->type = rng_uint32(&gx->rng) & 7;
+	// one field at a time, so each is a single batched draw
+	int first = gx->n_giblets;
+	rng_fill_floats(&gx->rng, gx->x + first, count, (float)x0, (float)w);
+	rng_fill_floats(&gx->rng, gx->y + first, count, (float)y0, (float)h);
+	rng_fill_floats(&gx->rng, gx->vx + first, count, -max_speed, 2.0f * max_speed);
+	rng_fill_floats(&gx->rng, gx->vy + first, count, -max_speed, 2.0f * max_speed);
+	memcpy(gx->prev_x + first, gx->x + first, count * sizeof(float));
+	memcpy(gx->prev_y + first, gx->y + first, count * sizeof(float));
+
+	for (int i = first; i < first + count; i++) {
+		gx->owner[i] = owner;
+		gx->type[i] = rng_uint32(&gx->rng) & 7;
+
+		// the landing height only depends on the owner and the ring
+		// position it spawned at, so it's worked out once, here
+		int seed_index = gx->next_giblet++;
+		if (gx->next_giblet >= gx->max_giblets) gx->next_giblet = 0;
+		struct rng rng;
+		rng_seed(&rng, owner * 54531 + seed_index);
+		int floor_dy = rng_uint32(&rng) % 28;
+		gx->floor_y[i] = (float)(base_floor_y + floor_dy - 14);
 	}
+	gx->n_giblets += count;
+	if (gx->n_giblets > gx->peak_giblets) gx->peak_giblets = gx->n_giblets;
+	giblet_exploder_owner_add(gx, owner, count);
+	gx->owner_index_dirty = 1;
 }
 
-static void giblet_exploder_update(struct giblet_exploder* gx, float dt)
+// moves giblets [i0;i1) one step and lists the ones that landed at
+// landed[i0...], returning how many did
+static int giblet_exploder_step(struct giblet_exploder* gx, float dt, int i0, int i1)
 {
 	float gravity = 40.0f;
-	int base_floor_y = 169;
-
-	for (int i = 0; i < MAX_GIBLETS; i++) {
-		struct giblet* g = &gx->giblets[i];
-		if (!g->active || g->grounded) continue;
-		g->vy += gravity * dt;
-		g->x += g->vx * dt;
-		g->y += g->vy * dt;
-		struct rng rng;
-		rng_seed(&rng, g->owner * 54531 + i);
-		int floor_dy = rng_uint32(&rng) % 28;
-		int floor_y = base_floor_y + floor_dy - 14;
-		if (g->y > floor_y) {
-			g->y = floor_y;
-			g->grounded = 1;
-			g->owner = 0;
+	int n_landed = 0;
+	int* landed = gx->landed + i0;
+	float* x = gx->x;
+	float* y = gx->y;
+	float* vx = gx->vx;
+	float* vy = gx->vy;
+	float* floor_y = gx->floor_y;
+
+	int i = i0;
+	#ifdef __SSE2__
+	__m128 gdt4 = _mm_set1_ps(gravity * dt);
+	__m128 dt4 = _mm_set1_ps(dt);
+	for (; i + 4 <= i1; i += 4) {
+		__m128 x4 = _mm_loadu_ps(x + i);
+		__m128 y4 = _mm_loadu_ps(y + i);
+		_mm_storeu_ps(gx->prev_x + i, x4);
+		_mm_storeu_ps(gx->prev_y + i, y4);
+		__m128 vy4 = _mm_add_ps(_mm_loadu_ps(vy + i), gdt4);
+		x4 = _mm_add_ps(x4, _mm_mul_ps(_mm_loadu_ps(vx + i), dt4));
+		y4 = _mm_add_ps(y4, _mm_mul_ps(vy4, dt4));
+		// landed giblets are parked on their floor until they're stamped
+		__m128 floor4 = _mm_loadu_ps(floor_y + i);
+		__m128 landed4 = _mm_cmpgt_ps(y4, floor4);
+		y4 = _mm_or_ps(_mm_and_ps(landed4, floor4), _mm_andnot_ps(landed4, y4));
+		_mm_storeu_ps(vy + i, vy4);
+		_mm_storeu_ps(x + i, x4);
+		_mm_storeu_ps(y + i, y4);
+		int mask = _mm_movemask_ps(landed4);
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			landed[n_landed++] = i + lane;
+			mask &= mask - 1;
+		}
+	}
+	#endif
+	for (; i < i1; i++) {
+		gx->prev_x[i] = x[i];
+		gx->prev_y[i] = y[i];
+		vy[i] += gravity * dt;
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+		if (y[i] > floor_y[i]) {
+			y[i] = floor_y[i];
+			landed[n_landed++] = i;
 		}
 	}
+	return n_landed;
+}
+
+struct giblet_step_job {
+	struct giblet_exploder* gx;
+	float dt;
+	int n;
+};
+
+static void giblet_step_job_run(void* userdata, int job)
+{
+	struct giblet_step_job* j = userdata;
+	int i0 = job * GIBLET_JOB_SIZE;
+	int i1 = i0 + GIBLET_JOB_SIZE < j->n ? i0 + GIBLET_JOB_SIZE : j->n;
+	j->gx->job_landed[job].n = giblet_exploder_step(j->gx, j->dt, i0, i1);
+}
+
+static void giblet_exploder_update(struct giblet_exploder* gx, float dt)
+{
+	int n = gx->n_giblets;
+	float* x = gx->x;
+	float* floor_y = gx->floor_y;
+
+	struct giblet_step_job job;
+	job.gx = gx;
+	job.dt = dt;
+	job.n = n;
+	int n_jobs = (n + GIBLET_JOB_SIZE - 1) / GIBLET_JOB_SIZE;
+	render_pool_run_jobs(gx->pool, giblet_step_job_run, &job, n_jobs);
+
+	// gather the landed lists in chunk order, so nothing depends on
+	// which thread ran what
+	int n_landed = 0;
+	for (int k = 0; k < n_jobs; k++) {
+		memmove(gx->landed + n_landed, gx->landed + k * GIBLET_JOB_SIZE, gx->job_landed[k].n * sizeof(int));
+		n_landed += gx->job_landed[k].n;
+	}
+
+	if (n_landed == 0) return;
+
+	// stamp the landed ones into the ground, then swap-remove them from
+	// the top down, so the giblet swapped in is always a survivor; only
+	// the order within an owner's render list shifts
+	for (int k = 0; k < n_landed; k++) {
+		int j = gx->landed[k];
+		img_blit(&gx->ground, &gx->img, gx->type[j] * 12, 0, (int)x[j], (int)floor_y[j], 12, 7);
+		giblet_exploder_owner_remove(gx, gx->owner[j]);
+	}
+	for (int k = n_landed - 1; k >= 0; k--) giblet_exploder_remove(gx, gx->landed[k]);
+	gx->owner_index_dirty = 1;
+}
+
+// the render lists are rebuilt on the first render after the giblets
+// changed, at most once per frame; only buckets of live owners are
+// touched, so it's O(n_giblets) however big the table is
+static void giblet_exploder_index_owners(struct giblet_exploder* gx)
+{
+	for (int i = 0; i < gx->n_giblets; i++) {
+		giblet_exploder_owner_bucket(gx, gx->owner[i], 0)->first = -1;
+	}
+	// backwards, so every list ends up in ascending (paint) order
+	for (int i = gx->n_giblets - 1; i >= 0; i--) {
+		struct giblet_owner_bucket* bucket = giblet_exploder_owner_bucket(gx, gx->owner[i], 0);
+		gx->next_owned[i] = bucket->first;
+		bucket->first = i;
+	}
+	gx->owner_index_dirty = 0;
+}
+
+// only looks at the counts, so the simulation never rebuilds the lists
+static int giblet_exploder_owns_any(struct giblet_exploder* gx, int owner)
+{
+	return giblet_exploder_owner_bucket(gx, owner, 0) != NULL;
+}
+
+static void giblet_exploder_render_ground(struct giblet_exploder* gx, struct screen* screen)
+{
+	screen_draw_img_opaque(screen, &gx->ground, 0, 0, 0, 0, gx->ground.width, gx->ground.height);
 }
 
-static void giblet_exploder_render(struct giblet_exploder* gx, uint32_t* screen, int owner)
+static void giblet_exploder_render(struct giblet_exploder* gx, struct screen* screen, int owner)
 {
-	for (int i = 0; i < MAX_GIBLETS; i++) {
-		struct giblet* g = &gx->giblets[i];
-		if (!g->active) continue;
-		if (g->owner != owner) continue;
-		int x = (int)g->x;
-		int y = (int)g->y;
-		screen_draw_img(screen, &gx->img, g->type * 12, 0, x, y, 12, 7);
+	if (gx->owner_index_dirty) giblet_exploder_index_owners(gx);
+	struct giblet_owner_bucket* bucket = giblet_exploder_owner_bucket(gx, owner, 0);
+	if (bucket == NULL) return;
+	for (int i = bucket->first; i != -1; i = gx->next_owned[i]) {
+		int x = (int)(gx->prev_x[i] + (gx->x[i] - gx->prev_x[i]) * gx->alpha);
+		int y = (int)(gx->prev_y[i] + (gx->y[i] - gx->prev_y[i]) * gx->alpha);
+		screen_draw_img(screen, &gx->img, gx->type[i] * 12, 0, x, y, 12, 7);
 	}
 }
 
+// bytes allocated for the pool and its index, not counting images
+static size_t giblet_exploder_memory(struct giblet_exploder* gx)
+{
+	size_t per_giblet = 7 * sizeof(float) + 4 * sizeof(int);
+	return (size_t)gx->max_giblets * per_giblet
+		+ (size_t)(gx->owner_bucket_mask + 1) * sizeof(*gx->owner_buckets)
+		+ (size_t)gx->ground.width * gx->ground.height * sizeof(uint32_t);
+}
+
+// live giblets plus the owner index; the ground is drawn into, not walked
+static size_t giblet_exploder_live_memory(struct giblet_exploder* gx)
+{
+	size_t per_giblet = 7 * sizeof(float) + 4 * sizeof(int);
+	return (size_t)gx->n_giblets * per_giblet
+		+ (size_t)(gx->owner_bucket_mask + 1) * sizeof(*gx->owner_buckets);
+}
+
+static uint64_t giblet_exploder_hash(struct giblet_exploder* gx, uint64_t h)
+{
+	int n = gx->n_giblets;
+	h = hash_bytes(h, &gx->rng, sizeof(gx->rng));
+	h = hash_bytes(h, &gx->n_giblets, sizeof(gx->n_giblets));
+	h = hash_bytes(h, &gx->next_giblet, sizeof(gx->next_giblet));
+	h = hash_bytes(h, &gx->evict_cursor, sizeof(gx->evict_cursor));
+	h = hash_bytes(h, gx->x, n * sizeof(float));
+	h = hash_bytes(h, gx->y, n * sizeof(float));
+	h = hash_bytes(h, gx->vx, n * sizeof(float));
+	h = hash_bytes(h, gx->vy, n * sizeof(float));
+	h = hash_bytes(h, gx->floor_y, n * sizeof(float));
+	h = hash_bytes(h, gx->type, n * sizeof(int));
+	h = hash_bytes(h, gx->owner, n * sizeof(int));
+	return hash_bytes(h, gx->ground.data, gx->ground.width * gx->ground.height * sizeof(uint32_t));
+}
+
+static void giblet_exploder_save(struct giblet_exploder* gx, struct snapshot* s)
+{
+	int n = gx->n_giblets;
+	SNAPSHOT_PUT(s, gx->max_giblets);
+	SNAPSHOT_PUT(s, gx->rng);
+	SNAPSHOT_PUT(s, gx->n_giblets);
+	SNAPSHOT_PUT(s, gx->next_giblet);
+	SNAPSHOT_PUT(s, gx->evict_cursor);
+	SNAPSHOT_PUT(s, gx->peak_giblets);
+	SNAPSHOT_PUT(s, gx->n_overflowed);
+	SNAPSHOT_PUT(s, gx->alpha);
+	snapshot_put(s, gx->x, n * sizeof(float));
+	snapshot_put(s, gx->y, n * sizeof(float));
+	snapshot_put(s, gx->prev_x, n * sizeof(float));
+	snapshot_put(s, gx->prev_y, n * sizeof(float));
+	snapshot_put(s, gx->vx, n * sizeof(float));
+	snapshot_put(s, gx->vy, n * sizeof(float));
+	snapshot_put(s, gx->floor_y, n * sizeof(float));
+	snapshot_put(s, gx->type, n * sizeof(int));
+	snapshot_put(s, gx->owner, n * sizeof(int));
+	snapshot_put(s, gx->ground.data, gx->ground.width * gx->ground.height * sizeof(uint32_t));
+}
+
+static void giblet_exploder_load(struct giblet_exploder* gx, struct snapshot* s)
+{
+	int max_giblets;
+	SNAPSHOT_GET(s, max_giblets);
+	if (max_giblets != gx->max_giblets) arghf("snapshot has room for %d giblets, not %d\n", max_giblets, gx->max_giblets);
+	giblet_exploder_clear_owners(gx);
+	SNAPSHOT_GET(s, gx->rng);
+	SNAPSHOT_GET(s, gx->n_giblets);
+	SNAPSHOT_GET(s, gx->next_giblet);
+	SNAPSHOT_GET(s, gx->evict_cursor);
+	SNAPSHOT_GET(s, gx->peak_giblets);
+	SNAPSHOT_GET(s, gx->n_overflowed);
+	SNAPSHOT_GET(s, gx->alpha);
+	int n = gx->n_giblets;
+	snapshot_get(s, gx->x, n * sizeof(float));
+	snapshot_get(s, gx->y, n * sizeof(float));
+	snapshot_get(s, gx->prev_x, n * sizeof(float));
+	snapshot_get(s, gx->prev_y, n * sizeof(float));
+	snapshot_get(s, gx->vx, n * sizeof(float));
+	snapshot_get(s, gx->vy, n * sizeof(float));
+	snapshot_get(s, gx->floor_y, n * sizeof(float));
+	snapshot_get(s, gx->type, n * sizeof(int));
+	snapshot_get(s, gx->owner, n * sizeof(int));
+	snapshot_get(s, gx->ground.data, gx->ground.width * gx->ground.height * sizeof(uint32_t));
+	for (int i = 0; i < n; i++) giblet_exploder_owner_add(gx, gx->owner[i], 1);
+	gx->owner_index_dirty = 1;
+}
+
 
+#ifndef MAX_ZOMBIES
 #define MAX_ZOMBIES (128)
+#endif
+
+// walking zombies per gib/walk job
+#define ZOMBIE_JOB_SIZE (2048)
 
+#define ZOMBIE_RNG_SEED (420)
+
+// what a zombie keeps for as long as it's in the depth order; the state
+// that changes every tick lives in the director's walking arrays
 struct zombie {
-	int active;
-	int frame;
 	int style;
-	int pause;
-	int stagger;
-	int gib;
-	int x;
 	int y;
 	int giblet_owner;
+	int walker; // index into the walking arrays, -1 once gibbed
 };
 
-static int zombie_effective_x(struct zombie* z)
+static inline int zombie_effective_x(int x, int frame)
 {
-	const int dx [] = {
+	static const int dx [] = {
 		120, // frame 1
 		115, // frame 2
 		104, // frame 3
@@ -1027,28 +3638,83 @@ static int zombie_effective_x(struct zombie* z)
 		69,  // frame 12
 
 	};
-	return z->x + dx[z->frame];
+	return x + dx[frame];
 }
 
 struct zombie_director {
 	struct img imgs[10];
 	struct rng rng;
 
+	int max_zombies;
+
 	// state
 	float dt_accum;
 	struct zombie* zombies;
+	// indices of listed zombies sorted by y (painter's order); y never
+	// changes after spawn so this is only touched on spawn and expiry.
+	// a zombie stays listed after it's gibbed, until its giblets land
+	int* order;
+	int n_order;
+	// zombies that are still walking (or mid-gib) as structure of
+	// arrays, unordered; gibbed ones are swap-removed
+	int n_walkers;
+	int* slot; // back to zombies[]
+	uint32_t* key; // the zombie's giblet owner, keys its random numbers
+	int* x;
+	int* frame;
+	int* pause;
+	int* stagger;
+	int* gib;
+	// scratch for zombie_director_walk()
+	int* effective_x;
+	int* roll_pause;
+	int* roll_stagger;
+	// scratch: zombies done gibbing; each gib job lists its own at the
+	// start of its chunk and counts them in job_finished
+	int* finished;
+	struct job_count* job_finished;
+	// stack of slots not in the depth order
+	int* free_slots;
+	int n_free;
+	// smallest zombie_effective_x() of the walking zombies (SCREEN_WIDTH
+	// if none); kept up to date on spawn and after every tick
+	int leftmost_x;
 	int spawn_counter;
 	int ticks;
 	int next_giblet_owner;
+
+	struct render_pool* pool; // runs gib and walk jobs, if set
 };
 
 
-static void zombie_director_init(struct zombie_director* zd)
+static void* zombie_director_alloc(int n, size_t size)
+{
+	void* p = calloc(n, size);
+	AN(p);
+	return p;
+}
+
+static void zombie_director_init(struct zombie_director* zd, int max_zombies)
 {
 	memset(zd, 0, sizeof*zd);
 
-	zd->zombies = calloc(MAX_ZOMBIES, sizeof(*zd->zombies));
-	AN(zd->zombies);
+	ASSERT(max_zombies > 0);
+	zd->max_zombies = max_zombies;
+	zd->zombies = zombie_director_alloc(max_zombies, sizeof(*zd->zombies));
+	zd->order = zombie_director_alloc(max_zombies, sizeof(*zd->order));
+	zd->slot = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->key = zombie_director_alloc(max_zombies, sizeof(uint32_t));
+	zd->x = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->frame = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->pause = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->stagger = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->gib = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->effective_x = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->roll_pause = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->roll_stagger = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->finished = zombie_director_alloc(max_zombies, sizeof(int));
+	zd->job_finished = zombie_director_alloc((max_zombies + ZOMBIE_JOB_SIZE - 1) / ZOMBIE_JOB_SIZE, sizeof(*zd->job_finished));
+	zd->free_slots = zombie_director_alloc(max_zombies, sizeof(*zd->free_slots));
 
 	const char* zs[] = {
 		"zombiep0.png",
@@ -1069,17 +3735,281 @@ static void zombie_director_init(struct zombie_director* zd)
 		img_load(img, zs[i]);
 		ASSERT(img->width == 163);
 		ASSERT(img->height == 984);
+		img_set_cells(img, 163, 82);
 	}
 }
 
+static void zombie_director_free(struct zombie_director* zd)
+{
+	for (int i = 0; i < 10; i++) img_free(&zd->imgs[i]);
+	free(zd->zombies);
+	free(zd->order);
+	free(zd->slot);
+	free(zd->key);
+	free(zd->x);
+	free(zd->frame);
+	free(zd->pause);
+	free(zd->stagger);
+	free(zd->gib);
+	free(zd->effective_x);
+	free(zd->roll_pause);
+	free(zd->roll_stagger);
+	free(zd->finished);
+	free(zd->job_finished);
+	free(zd->free_slots);
+	memset(zd, 0, sizeof(*zd));
+}
+
 static void zombie_director_reset(struct zombie_director* zd)
 {
-	rng_seed(&zd->rng, 420);
-	zd->dt_accum = 0;
-	memset(zd->zombies, 0, sizeof(*zd->zombies) * MAX_ZOMBIES);
-	zd->spawn_counter = 0;
-	zd->ticks = 0;
-	zd->next_giblet_owner = 0;
+	rng_seed(&zd->rng, ZOMBIE_RNG_SEED);
+	zd->dt_accum = 0;
+	memset(zd->zombies, 0, sizeof(*zd->zombies) * zd->max_zombies);
+	zd->n_order = 0;
+	zd->n_walkers = 0;
+	zd->leftmost_x = SCREEN_WIDTH;
+	// lowest slot on top
+	zd->n_free = zd->max_zombies;
+	for (int i = 0; i < zd->max_zombies; i++) {
+		zd->free_slots[i] = zd->max_zombies - 1 - i;
+	}
+	zd->spawn_counter = 0;
+	zd->ticks = 0;
+	zd->next_giblet_owner = 0;
+}
+
+// returns the new zombie's index into the walking arrays, or -1 if full
+static int zombie_director_spawn(struct zombie_director* zd, int x, int y, int style)
+{
+	if (zd->n_free == 0) return -1;
+	int index = zd->free_slots[--zd->n_free];
+
+	int w = zd->n_walkers++;
+	zd->slot[w] = index;
+	zd->x[w] = x;
+	zd->frame[w] = 0;
+	zd->pause[w] = 0;
+	zd->stagger[w] = 0;
+	zd->gib[w] = 0;
+
+	struct zombie* z = &zd->zombies[index];
+	z->y = y;
+	z->style = style;
+	z->giblet_owner = ++zd->next_giblet_owner;
+	z->walker = w;
+	zd->key[w] = z->giblet_owner;
+	int zx = zombie_effective_x(x, 0);
+	if (zx < zd->leftmost_x) zd->leftmost_x = zx;
+
+	// insert after any zombie with the same y, so ties keep spawn order
+	int lo = 0;
+	int hi = zd->n_order;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (zd->zombies[zd->order[mid]].y <= y) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	memmove(&zd->order[lo + 1], &zd->order[lo], (zd->n_order - lo) * sizeof(*zd->order));
+	zd->order[lo] = index;
+	zd->n_order++;
+
+	return w;
+}
+
+// drop gibbed zombies from the depth order once their giblets have landed,
+// freeing their slots
+static void zombie_director_expire(struct zombie_director* zd, struct giblet_exploder* gx)
+{
+	int n = 0;
+	for (int i = 0; i < zd->n_order; i++) {
+		struct zombie* z = &zd->zombies[zd->order[i]];
+		if (z->walker == -1 && !giblet_exploder_owns_any(gx, z->giblet_owner)) {
+			// free slots stay zeroed, so snapshots can leave them out
+			memset(z, 0, sizeof(*z));
+			zd->free_slots[zd->n_free++] = zd->order[i];
+			continue;
+		}
+		zd->order[n++] = zd->order[i];
+	}
+	zd->n_order = n;
+}
+
+static void zombie_director_update_leftmost_x(struct zombie_director* zd)
+{
+	int x = SCREEN_WIDTH;
+	for (int i = 0; i < zd->n_walkers; i++) {
+		int zx = zombie_effective_x(zd->x[i], zd->frame[i]);
+		if (zx < x) x = zx;
+	}
+	zd->leftmost_x = x;
+}
+
+// what landing on a frame (-1 to 12, before wrapping) rolls for
+#define ZOMBIE_ROLL_PAUSE (1)
+#define ZOMBIE_ROLL_STAGGER (2)
+static const uint8_t zombie_frame_rolls[] = {
+	0,                                      // -1
+	ZOMBIE_ROLL_PAUSE | ZOMBIE_ROLL_STAGGER, // 0
+	0, 0,                                   // 1, 2
+	ZOMBIE_ROLL_PAUSE,                      // 3
+	0,                                      // 4
+	ZOMBIE_ROLL_PAUSE,                      // 5
+	ZOMBIE_ROLL_PAUSE | ZOMBIE_ROLL_STAGGER, // 6
+	0, 0,                                   // 7, 8
+	ZOMBIE_ROLL_PAUSE,                      // 9
+	0,                                      // 10
+	ZOMBIE_ROLL_PAUSE,                      // 11
+	0,                                      // 12
+};
+
+// one walking step for every zombie that isn't mid-gib or pausing, in
+// passes free of branches on zombie state: first the per zombie lookups
+// and random rolls, then the state machine itself, four at a time with
+// SSE2. zombies whose effective x is below death_x start gibbing. only
+// touches walkers [i0;i1)
+static void zombie_director_walk(struct zombie_director* zd, int death_x, int i0, int i1)
+{
+	int zombie_cycle_dx = 60;
+	int zombie_frame_count = 12;
+
+	int n = i1;
+	int* x = zd->x;
+	int* frame = zd->frame;
+	int* pause = zd->pause;
+	int* stagger = zd->stagger;
+	int* gib = zd->gib;
+	int* effective_x = zd->effective_x;
+	int* roll_pause = zd->roll_pause;
+	int* roll_stagger = zd->roll_stagger;
+
+	// random numbers are keyed by zombie and tick, so the order zombies
+	// are visited in doesn't matter
+	for (int i = i0; i < n; i++) {
+		effective_x[i] = zombie_effective_x(x[i], frame[i]);
+		uint32_t ri = rng_hash(zd->key[i], zd->ticks);
+		roll_pause[i] = ri%4;
+		roll_stagger[i] = ((ri/10)%3) == 0;
+	}
+
+	int i = i0;
+	#ifdef __SSE2__
+	__m128i zero4 = _mm_setzero_si128();
+	__m128i one4 = _mm_set1_epi32(1);
+	__m128i death_x4 = _mm_set1_epi32(death_x);
+	__m128i frame_count4 = _mm_set1_epi32(zombie_frame_count);
+	__m128i last_frame4 = _mm_set1_epi32(zombie_frame_count - 1);
+	__m128i cycle_dx4 = _mm_set1_epi32(zombie_cycle_dx);
+	for (; i + 4 <= n; i += 4) {
+		__m128i gib4 = _mm_loadu_si128((__m128i*)(gib + i));
+		__m128i pause4 = _mm_loadu_si128((__m128i*)(pause + i));
+		__m128i stagger4 = _mm_loadu_si128((__m128i*)(stagger + i));
+		__m128i frame4 = _mm_loadu_si128((__m128i*)(frame + i));
+		__m128i x4 = _mm_loadu_si128((__m128i*)(x + i));
+
+		// zombies already mid-gib stand still
+		__m128i walking4 = _mm_cmpeq_epi32(gib4, zero4);
+
+		// handle zombie death
+		__m128i die4 = _mm_and_si128(walking4, _mm_cmplt_epi32(_mm_loadu_si128((__m128i*)(effective_x + i)), death_x4));
+		gib4 = _mm_or_si128(gib4, _mm_and_si128(die4, one4));
+
+		// pause (masks are -1, so adding one counts down)
+		__m128i paused4 = _mm_cmpgt_epi32(pause4, zero4);
+		pause4 = _mm_add_epi32(pause4, _mm_and_si128(walking4, paused4));
+		__m128i step4 = _mm_andnot_si128(paused4, walking4);
+
+		// staggering and anim personality
+		__m128i f4 = _mm_add_epi32(frame4, _mm_sub_epi32(one4, _mm_add_epi32(stagger4, stagger4)));
+		__m128i roll_stagger4 = _mm_or_si128(_mm_cmpeq_epi32(f4, _mm_set1_epi32(0)), _mm_cmpeq_epi32(f4, _mm_set1_epi32(6)));
+		__m128i roll_pause4 = _mm_or_si128(
+			_mm_or_si128(roll_stagger4, _mm_cmpeq_epi32(f4, _mm_set1_epi32(3))),
+			_mm_or_si128(
+				_mm_cmpeq_epi32(f4, _mm_set1_epi32(5)),
+				_mm_or_si128(_mm_cmpeq_epi32(f4, _mm_set1_epi32(9)), _mm_cmpeq_epi32(f4, _mm_set1_epi32(11)))));
+		__m128i new_stagger4 = _mm_and_si128(roll_stagger4, _mm_loadu_si128((__m128i*)(roll_stagger + i)));
+		__m128i new_pause4 = _mm_and_si128(roll_pause4, _mm_loadu_si128((__m128i*)(roll_pause + i)));
+
+		// wrap / advance x
+		__m128i over4 = _mm_cmpgt_epi32(f4, last_frame4);
+		__m128i under4 = _mm_cmplt_epi32(f4, zero4);
+		f4 = _mm_add_epi32(_mm_sub_epi32(f4, _mm_and_si128(over4, frame_count4)), _mm_and_si128(under4, frame_count4));
+		__m128i nx4 = _mm_add_epi32(_mm_sub_epi32(x4, _mm_and_si128(over4, cycle_dx4)), _mm_and_si128(under4, cycle_dx4));
+
+		#define ZOMBIE_SELECT(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+		_mm_storeu_si128((__m128i*)(gib + i), gib4);
+		_mm_storeu_si128((__m128i*)(frame + i), ZOMBIE_SELECT(step4, f4, frame4));
+		_mm_storeu_si128((__m128i*)(x + i), ZOMBIE_SELECT(step4, nx4, x4));
+		_mm_storeu_si128((__m128i*)(stagger + i), ZOMBIE_SELECT(step4, new_stagger4, stagger4));
+		_mm_storeu_si128((__m128i*)(pause + i), ZOMBIE_SELECT(step4, new_pause4, pause4));
+		#undef ZOMBIE_SELECT
+	}
+	#endif
+	for (; i < n; i++) {
+		int walking = gib[i] == 0;
+		gib[i] |= walking & (effective_x[i] < death_x);
+
+		int paused = pause[i] > 0;
+		pause[i] -= walking & paused;
+		int step = walking & !paused;
+
+		int f = frame[i] + 1 - 2 * stagger[i];
+		int rolls = zombie_frame_rolls[f + 1];
+		int new_stagger = (rolls & ZOMBIE_ROLL_STAGGER) ? roll_stagger[i] : 0;
+		int new_pause = (rolls & ZOMBIE_ROLL_PAUSE) ? roll_pause[i] : 0;
+
+		int wrap = (f >= zombie_frame_count) - (f < 0);
+		f -= wrap * zombie_frame_count;
+		int nx = x[i] - wrap * zombie_cycle_dx;
+
+		frame[i] = step ? f : frame[i];
+		x[i] = step ? nx : x[i];
+		stagger[i] = step ? new_stagger : stagger[i];
+		pause[i] = step ? new_pause : pause[i];
+	}
+}
+
+#define ZOMBIE_GIB_DURATION (7)
+
+struct zombie_job {
+	struct zombie_director* zd;
+	int n;
+	int death_x;
+};
+
+static void zombie_job_range(struct zombie_job* j, int job, int* i0, int* i1)
+{
+	*i0 = job * ZOMBIE_JOB_SIZE;
+	*i1 = *i0 + ZOMBIE_JOB_SIZE < j->n ? *i0 + ZOMBIE_JOB_SIZE : j->n;
+}
+
+// advances the gib animation of a chunk and lists the zombies in it that
+// are done gibbing; banging and removing them is left to the caller
+static void zombie_gib_job_run(void* userdata, int job)
+{
+	struct zombie_job* j = userdata;
+	int i0, i1;
+	zombie_job_range(j, job, &i0, &i1);
+	int* gib = j->zd->gib;
+	int* finished = j->zd->finished + i0;
+	int n_finished = 0;
+	for (int i = i0; i < i1; i++) {
+		int g = gib[i];
+		gib[i] = g + (g != 0);
+		finished[n_finished] = i;
+		n_finished += g >= ZOMBIE_GIB_DURATION;
+	}
+	j->zd->job_finished[job].n = n_finished;
+}
+
+static void zombie_walk_job_run(void* userdata, int job)
+{
+	struct zombie_job* j = userdata;
+	int i0, i1;
+	zombie_job_range(j, job, &i0, &i1);
+	zombie_director_walk(j->zd, j->death_x, i0, i1);
 }
 
 static void zombie_director_update(struct zombie_director* zd, struct piano_roll* piano_roll, float dt, struct giblet_exploder* gx)
@@ -1089,9 +4019,6 @@ static void zombie_director_update(struct zombie_director* zd, struct piano_roll
 	int zombie_start_x = 270;
 	int zombie_start_y = 75;
 	int zombie_start_y_spread = 30;
-	int zombie_cycle_dx = 60;
-	int zombie_frame_count = 12;
-	int gib_duration = 7;
 
 	zd->dt_accum += dt;
 
@@ -1102,100 +4029,73 @@ static void zombie_director_update(struct zombie_director* zd, struct piano_roll
 		if (zd->spawn_counter > spawn_ticks) {
 			float rf = rng_float(&zd->rng);
 			if (rf > (gauge * 0.8)) {
-				struct zombie* found = NULL;
-				for (int i = 0; i < MAX_ZOMBIES; i++) {
-					struct zombie* z = &zd->zombies[i];
-					if (!z->active) {
-						found = z;
-						break;
-					}
-				}
-				if (found != NULL) {
+				if (zd->n_free > 0) {
 					uint32_t ri = rng_uint32(&zd->rng);
-					found->active = 1;
-					found->frame = 0;
-					found->x = zombie_start_x;
-					found->y = zombie_start_y + (ri%zombie_start_y_spread);
-					found->style = (ri>>5)%10;
-					found->giblet_owner = ++zd->next_giblet_owner;
+					zombie_director_spawn(
+						zd,
+						zombie_start_x,
+						zombie_start_y + (ri%zombie_start_y_spread),
+						(ri>>5)%10);
 				}
 			}
 
 			zd->spawn_counter = 0;
 		}
 
-		// animate the dead
-		for (int i = 0; i < MAX_ZOMBIES; i++) {
-			struct zombie* z = &zd->zombies[i];
-
-			if (!z->active) continue;
-
-			// zombie gib animation
-			if (z->gib) {
-				z->gib++;
-				if (z->gib > gib_duration) {
-					z->active = 0;
-					giblet_exploder_bang(
-						gx, 
-						zombie_effective_x(z) + 24,
-						z->y + 11,
-						18,
-						71,
-						z->giblet_owner);
-					continue;
+		// animate the dead: gibbing goes on every tick, walking on
+		// every other one
+
+		// zombie gib animation
+		struct zombie_job job;
+		job.zd = zd;
+		job.n = zd->n_walkers;
+		int n_jobs = (job.n + ZOMBIE_JOB_SIZE - 1) / ZOMBIE_JOB_SIZE;
+		render_pool_run_jobs(zd->pool, zombie_gib_job_run, &job, n_jobs);
+
+		// bang and remove the finished ones backwards, chunk by chunk,
+		// so whatever gets swapped in has been seen already and the
+		// outcome is the same however the jobs were run
+		for (int k = n_jobs - 1; k >= 0; k--) {
+			for (int f = zd->job_finished[k].n - 1; f >= 0; f--) {
+				int i = zd->finished[k * ZOMBIE_JOB_SIZE + f];
+				struct zombie* z = &zd->zombies[zd->slot[i]];
+				giblet_exploder_bang(
+					gx,
+					zombie_effective_x(zd->x[i], zd->frame[i]) + 24,
+					z->y + 11,
+					18,
+					71,
+					z->giblet_owner);
+				z->walker = -1;
+				int last = --zd->n_walkers;
+				if (i != last) {
+					zd->slot[i] = zd->slot[last];
+					zd->key[i] = zd->key[last];
+					zd->x[i] = zd->x[last];
+					zd->frame[i] = zd->frame[last];
+					zd->pause[i] = zd->pause[last];
+					zd->stagger[i] = zd->stagger[last];
+					zd->gib[i] = zd->gib[last];
+					zd->zombies[zd->slot[i]].walker = i;
 				}
 			}
+		}
 
-			if (z->gib) continue;
-
-			if (zd->ticks&1) continue;
-
-			// handle zombie death
-			int effective_x = zombie_effective_x(z);
-			float effective_xf = (float)effective_x / (float)SCREEN_WIDTH;
-			int zombie_must_die = 0;
-			if (effective_xf < gauge*0.8) {
-				zombie_must_die = 1;
-			}
-			if (zombie_must_die) z->gib = 1;
-			
-			// pause
-			if (z->pause > 0) {
-				z->pause--;
-				continue;
-			}
-			
-			// staggering and anim personality
-			uint32_t ri = rng_uint32(&zd->rng);
-			if (z->stagger) {
-				z->stagger = 0;
-				z->frame--;
-			} else {
-				z->frame++;
-			}
-			switch (z->frame) {
-				case 0: case 6: // stagger?
-					z->stagger = ((ri/10)%3) == 0;
-					z->pause = ri%4;
-					break;
-				case 11: case 5: // stagger?
-					z->pause = ri%4;
-					break;
-				case 3: case 9: // pause?
-					z->pause = ri%4;
-					break;
-			}
-
-			// wrap / advance x
-			if (z->frame >= zombie_frame_count) {
-				z->x -= zombie_cycle_dx;
-				z->frame -= zombie_frame_count;
-			} else if (z->frame < 0) {
-				z->x += zombie_cycle_dx;
-				z->frame += zombie_frame_count;
-			}
+		if ((zd->ticks&1) == 0) {
+			// the first effective x that survives, found with the same
+			// float test the death check has always used
+			double death_xf = gauge*0.8;
+			int death_x = (int)floor(death_xf * SCREEN_WIDTH) - 2;
+			while ((float)death_x / (float)SCREEN_WIDTH < death_xf) death_x++;
+			job.n = zd->n_walkers;
+			job.death_x = death_x;
+			n_jobs = (job.n + ZOMBIE_JOB_SIZE - 1) / ZOMBIE_JOB_SIZE;
+			render_pool_run_jobs(zd->pool, zombie_walk_job_run, &job, n_jobs);
 		}
 
+		zombie_director_update_leftmost_x(zd);
+		zombie_director_expire(zd, gx);
+
 		zd->spawn_counter++;
 		zd->ticks++;
 		zd->dt_accum -= tick_time;
@@ -1204,40 +4104,417 @@ static void zombie_director_update(struct zombie_director* zd, struct piano_roll
 
 static int zombie_director_get_leftmost_x(struct zombie_director* zd)
 {
-	int x = SCREEN_WIDTH;
-	for (int i = 0; i < MAX_ZOMBIES; i++) {
-		struct zombie* z = &zd->zombies[i];
-		if (!z->active) continue;
-		int zx = zombie_effective_x(z);
-		if (zx < x) x = zx;
+	return zd->leftmost_x;
+}
+
+static void zombie_director_render(struct zombie_director* zd, struct screen* screen, struct giblet_exploder* gx)
+{
+	int anim_offset = 82;
+	for (int i = 0; i < zd->n_order; i++) {
+		struct zombie* z = &zd->zombies[zd->order[i]];
+		giblet_exploder_render(gx, screen, z->giblet_owner);
+		int w = z->walker;
+		if (w == -1) continue;
+		int pain = zd->gib[w] & 1;
+		screen_draw_img_pain(screen, &zd->imgs[z->style], 0, anim_offset * zd->frame[w], zd->x[w], z->y, 163, anim_offset, pain);
 	}
-	return x;
+}
 
+// bytes allocated for the zombie slots and their lists, not counting images
+static size_t zombie_director_memory(struct zombie_director* zd)
+{
+	return (size_t)zd->max_zombies * (sizeof(*zd->zombies) + sizeof(*zd->order) + sizeof(*zd->free_slots) + 11 * sizeof(int));
 }
 
-static int zombie_y_sort(const void* va, const void* vb)
+// what an update actually touches: the walker columns and the ordered zombies
+static size_t zombie_director_live_memory(struct zombie_director* zd)
 {
-	const struct zombie* a = va;
-	const struct zombie* b = vb;
-	return a->y - b->y;
+	return (size_t)zd->n_walkers * 11 * sizeof(int)
+		+ (size_t)zd->n_order * (sizeof(*zd->zombies) + sizeof(*zd->order));
 }
 
-static void zombie_director_render(struct zombie_director* zd, uint32_t* screen, struct giblet_exploder* gx)
+static uint64_t zombie_director_hash(struct zombie_director* zd, uint64_t h)
 {
-	qsort(zd->zombies, MAX_ZOMBIES, sizeof(struct zombie), zombie_y_sort);
-	int anim_offset = 82;
+	int n = zd->n_walkers;
+	h = hash_bytes(h, &zd->rng, sizeof(zd->rng));
+	h = hash_bytes(h, &zd->dt_accum, sizeof(zd->dt_accum));
+	h = hash_bytes(h, zd->zombies, zd->max_zombies * sizeof(*zd->zombies));
+	h = hash_bytes(h, &zd->n_order, sizeof(zd->n_order));
+	h = hash_bytes(h, zd->order, zd->n_order * sizeof(*zd->order));
+	h = hash_bytes(h, &zd->n_walkers, sizeof(zd->n_walkers));
+	h = hash_bytes(h, zd->slot, n * sizeof(int));
+	h = hash_bytes(h, zd->x, n * sizeof(int));
+	h = hash_bytes(h, zd->frame, n * sizeof(int));
+	h = hash_bytes(h, zd->pause, n * sizeof(int));
+	h = hash_bytes(h, zd->stagger, n * sizeof(int));
+	h = hash_bytes(h, zd->gib, n * sizeof(int));
+	h = hash_bytes(h, &zd->spawn_counter, sizeof(zd->spawn_counter));
+	h = hash_bytes(h, &zd->ticks, sizeof(zd->ticks));
+	return hash_bytes(h, &zd->next_giblet_owner, sizeof(zd->next_giblet_owner));
+}
+
+static void zombie_director_save(struct zombie_director* zd, struct snapshot* s)
+{
+	int n = zd->n_walkers;
+	SNAPSHOT_PUT(s, zd->max_zombies);
+	SNAPSHOT_PUT(s, zd->rng);
+	SNAPSHOT_PUT(s, zd->dt_accum);
+	// only slots in the depth order are in use; the rest are zeroed
+	SNAPSHOT_PUT(s, zd->n_order);
+	snapshot_put(s, zd->order, zd->n_order * sizeof(*zd->order));
+	for (int i = 0; i < zd->n_order; i++) SNAPSHOT_PUT(s, zd->zombies[zd->order[i]]);
+	SNAPSHOT_PUT(s, zd->n_walkers);
+	snapshot_put(s, zd->slot, n * sizeof(int));
+	snapshot_put(s, zd->key, n * sizeof(uint32_t));
+	snapshot_put(s, zd->x, n * sizeof(int));
+	snapshot_put(s, zd->frame, n * sizeof(int));
+	snapshot_put(s, zd->pause, n * sizeof(int));
+	snapshot_put(s, zd->stagger, n * sizeof(int));
+	snapshot_put(s, zd->gib, n * sizeof(int));
+	// the bottom of the free stack is mostly still as reset left it
+	int n_fresh = 0;
+	while (n_fresh < zd->n_free && zd->free_slots[n_fresh] == zd->max_zombies - 1 - n_fresh) n_fresh++;
+	SNAPSHOT_PUT(s, zd->n_free);
+	SNAPSHOT_PUT(s, n_fresh);
+	snapshot_put(s, zd->free_slots + n_fresh, (zd->n_free - n_fresh) * sizeof(*zd->free_slots));
+	SNAPSHOT_PUT(s, zd->leftmost_x);
+	SNAPSHOT_PUT(s, zd->spawn_counter);
+	SNAPSHOT_PUT(s, zd->ticks);
+	SNAPSHOT_PUT(s, zd->next_giblet_owner);
+}
+
+static void zombie_director_load(struct zombie_director* zd, struct snapshot* s)
+{
+	int max_zombies;
+	SNAPSHOT_GET(s, max_zombies);
+	if (max_zombies != zd->max_zombies) arghf("snapshot has room for %d zombies, not %d\n", max_zombies, zd->max_zombies);
+	SNAPSHOT_GET(s, zd->rng);
+	SNAPSHOT_GET(s, zd->dt_accum);
+	memset(zd->zombies, 0, sizeof(*zd->zombies) * zd->max_zombies);
+	SNAPSHOT_GET(s, zd->n_order);
+	snapshot_get(s, zd->order, zd->n_order * sizeof(*zd->order));
+	for (int i = 0; i < zd->n_order; i++) SNAPSHOT_GET(s, zd->zombies[zd->order[i]]);
+	SNAPSHOT_GET(s, zd->n_walkers);
+	int n = zd->n_walkers;
+	snapshot_get(s, zd->slot, n * sizeof(int));
+	snapshot_get(s, zd->key, n * sizeof(uint32_t));
+	snapshot_get(s, zd->x, n * sizeof(int));
+	snapshot_get(s, zd->frame, n * sizeof(int));
+	snapshot_get(s, zd->pause, n * sizeof(int));
+	snapshot_get(s, zd->stagger, n * sizeof(int));
+	snapshot_get(s, zd->gib, n * sizeof(int));
+	int n_fresh;
+	SNAPSHOT_GET(s, zd->n_free);
+	SNAPSHOT_GET(s, n_fresh);
+	for (int i = 0; i < n_fresh; i++) zd->free_slots[i] = zd->max_zombies - 1 - i;
+	snapshot_get(s, zd->free_slots + n_fresh, (zd->n_free - n_fresh) * sizeof(*zd->free_slots));
+	SNAPSHOT_GET(s, zd->leftmost_x);
+	SNAPSHOT_GET(s, zd->spawn_counter);
+	SNAPSHOT_GET(s, zd->ticks);
+	SNAPSHOT_GET(s, zd->next_giblet_owner);
+}
+
+// time what rendering costs for a full giblet pool, half of it already
+// landed, spread over every zombie slot
+static void bench_giblets(void)
+{
+	struct screen screen;
+	screen_init(&screen, 1);
+
+	struct img bg_img;
+	img_load(&bg_img, "background.png");
+
+	struct giblet_exploder gx;
+	giblet_exploder_init(&gx, &bg_img, MAX_GIBLETS);
+	giblet_exploder_reset(&gx);
+
+	int n_owners = MAX_ZOMBIES;
+	for (int i = 0; i < MAX_GIBLETS / 50; i++) {
+		giblet_exploder_bang(&gx, 100 + (i % 200), 80, 18, 71, 1 + (i % n_owners));
+		if (i == MAX_GIBLETS / 100) {
+			for (int j = 0; j < SIM_HZ * 5; j++) giblet_exploder_update(&gx, SIM_DT);
+		}
+	}
+
+	int n_frames = 100;
+	uint64_t ticks = 0;
+	int n_cmds = 0;
+	for (int frame = 0; frame < n_frames; frame++) {
+		giblet_exploder_update(&gx, SIM_DT);
+		screen_begin_frame(&screen);
+		uint64_t t0 = SDL_GetPerformanceCounter();
+		giblet_exploder_render_ground(&gx, &screen);
+		for (int owner = 1; owner <= n_owners; owner++) {
+			giblet_exploder_render(&gx, &screen, owner);
+		}
+		ticks += SDL_GetPerformanceCounter() - t0;
+		n_cmds += screen.n_cmds;
+	}
+
+	double ms = ((double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency()) / (double)n_frames;
+	printf("giblets: %d giblets, %d owners, %.1f draws/frame: %.4f ms/frame\n", MAX_GIBLETS, n_owners + 1, (double)n_cmds / n_frames, ms);
+
+	giblet_exploder_free(&gx);
+	img_free(&bg_img);
+	screen_free(&screen);
+}
+
+// time giblet physics alone for a few pool sizes: each pool is filled by
+// bangs spread over the screen, then stepped for a second of game time;
+// then time spawning on its own
+static void bench_giblet_physics(void)
+{
+	struct img bg_img;
+	img_load(&bg_img, "background.png");
+
+	const int sizes[] = {512, 65536, 1048576};
+	const int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+	for (int s = 0; s < n_sizes; s++) {
+		struct giblet_exploder gx;
+		giblet_exploder_init(&gx, &bg_img, sizes[s]);
+		giblet_exploder_reset(&gx);
+		for (int i = 0; i < (sizes[s] + 49) / 50; i++) {
+			giblet_exploder_bang(&gx, 20 + (i * 7) % 300, 80, 18, 71, 1 + (i % MAX_ZOMBIES));
+		}
+
+		int n_start = gx.n_giblets;
+		int n_ticks = SIM_HZ;
+		uint64_t t0 = SDL_GetPerformanceCounter();
+		for (int tick = 0; tick < n_ticks; tick++) giblet_exploder_update(&gx, SIM_DT);
+		uint64_t ticks = SDL_GetPerformanceCounter() - t0;
+
+		double ms = ((double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency()) / (double)n_ticks;
+		printf("giblet physics: %7d giblets (%7d left after %d ticks): %.4f ms/tick\n", n_start, gx.n_giblets, n_ticks, ms);
+		giblet_exploder_free(&gx);
+	}
+
+	// spawning alone, emptying the pool before it has to evict
+	struct giblet_exploder gx;
+	giblet_exploder_init(&gx, &bg_img, MAX_GIBLETS);
+	giblet_exploder_reset(&gx);
+	int n_bangs = 100000;
+	uint64_t t0 = SDL_GetPerformanceCounter();
+	for (int i = 0; i < n_bangs; i++) {
+		if (gx.n_giblets + 50 > gx.max_giblets) giblet_exploder_reset(&gx);
+		giblet_exploder_bang(&gx, 20 + (i * 7) % 300, 80, 18, 71, 1 + (i % MAX_ZOMBIES));
+	}
+	uint64_t ticks = SDL_GetPerformanceCounter() - t0;
+	printf("giblet spawn: %.2f ns/giblet\n", ((double)ticks * 1e9 / (double)SDL_GetPerformanceFrequency()) / (double)(n_bangs * 50));
+
+	giblet_exploder_free(&gx);
+	img_free(&bg_img);
+}
+
+// time depth ordered zombie rendering with every zombie slot in use,
+// walking and then all flashing white mid-gib
+static void bench_zombies(void)
+{
+	struct screen screen;
+	screen_init(&screen, 1);
+
+	struct img bg_img;
+	img_load(&bg_img, "background.png");
+
+	struct giblet_exploder gx;
+	giblet_exploder_init(&gx, &bg_img, MAX_GIBLETS);
+	giblet_exploder_reset(&gx);
+
+	struct zombie_director zd;
+	zombie_director_init(&zd, MAX_ZOMBIES);
+	zombie_director_reset(&zd);
 	for (int i = 0; i < MAX_ZOMBIES; i++) {
-		struct zombie* z = &zd->zombies[i];
-		giblet_exploder_render(gx, screen, z->giblet_owner);
-		if (!z->active) continue;
-		int pain = z->gib & 1;
-		screen_draw_img_pain(screen, &zd->imgs[z->style], 0, anim_offset * z->frame, z->x, z->y, 163, anim_offset, pain);
+		uint32_t ri = rng_uint32(&zd.rng);
+		int w = zombie_director_spawn(&zd, (int)(ri % SCREEN_WIDTH) - 80, 75 + (ri >> 8) % 30, (ri >> 16) % 10);
+		ASSERT(w >= 0);
+		zd.frame[w] = (ri >> 20) % 12;
+	}
+
+	double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	for (int pain = 0; pain < 2; pain++) {
+		for (int i = 0; i < zd.n_walkers; i++) zd.gib[i] = pain;
+
+		int n_frames = 100;
+		uint64_t record_ticks = 0;
+		uint64_t raster_ticks = 0;
+		int n_cmds = 0;
+		int64_t pixel_visits = 0;
+		for (int frame = 0; frame < n_frames; frame++) {
+			screen_begin_frame(&screen);
+			uint64_t t0 = SDL_GetPerformanceCounter();
+			zombie_director_render(&zd, &screen, &gx);
+			uint64_t t1 = SDL_GetPerformanceCounter();
+			screen_end_frame(&screen);
+			record_ticks += t1 - t0;
+			raster_ticks += SDL_GetPerformanceCounter() - t1;
+			n_cmds += screen.n_cmds;
+			pixel_visits += screen.pixel_visits;
+		}
+
+		printf("zombies%s: %d zombies, %.1f draws/frame: %.4f ms/frame, rasterize %.4f ms/frame, %.0f px visited/frame\n",
+			pain ? " (flashing)" : "",
+			MAX_ZOMBIES,
+			(double)n_cmds / n_frames,
+			(double)record_ticks * ms / n_frames,
+			(double)raster_ticks * ms / n_frames,
+			(double)pixel_visits / n_frames);
+	}
+
+	zombie_director_free(&zd);
+	giblet_exploder_free(&gx);
+	img_free(&bg_img);
+	screen_free(&screen);
+}
+
+
+// horde stress mode: zombies walk in at spawn_rate per second until they
+// hit max_zombies, and get gibbed a little left of the middle, so both
+// pools are driven hard at a fixed timestep. prints a line per second of
+// game time with per subsystem update and render times and memory.
+// zombie and giblet updates and rasterization run on pool; returns the
+// mean zombie plus giblet update time per frame in ms
+static double bench_horde(struct render_pool* pool, int max_zombies, int max_giblets, int spawn_rate, int n_frames)
+{
+	struct screen screen;
+	screen_init(&screen, 1);
+	screen.pool = pool;
+
+	struct img bg_img;
+	img_load(&bg_img, "background.png");
+
+	struct giblet_exploder gx;
+	giblet_exploder_init(&gx, &bg_img, max_giblets);
+	giblet_exploder_reset(&gx);
+	gx.pool = pool;
+
+	struct zombie_director zd;
+	zombie_director_init(&zd, max_zombies);
+	zombie_director_reset(&zd);
+	zd.pool = pool;
+
+	// the director only looks at the gauge
+	struct piano_roll piano_roll;
+	memset(&piano_roll, 0, sizeof(piano_roll));
+	piano_roll.gauge = 0.5f;
+
+	struct rng rng;
+	rng_seed(&rng, 1);
+
+	printf("horde: %d zombies, %d giblets, %d spawns/s, %d frames, %d thread(s)\n", max_zombies, max_giblets, spawn_rate, n_frames, pool->n_threads);
+	printf("horde: memory: zombies %.1f MB, giblets %.1f MB\n",
+		(double)zombie_director_memory(&zd) / (1 << 20),
+		(double)giblet_exploder_memory(&gx) / (1 << 20));
+	printf("%6s %7s %8s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+		"frame", "zombies", "giblets", "z update", "g update", "g ground", "r actors", "rasterize", "worst", "cmds MB", "z live KB", "g live KB");
+
+	double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	uint64_t ticks[6] = {0}; // zombies, giblets, ground, actors, rasterize, frame
+	uint64_t worst = 0;
+	uint64_t update_ticks = 0;
+	float spawn_accum = 0;
+	for (int frame = 1; frame <= n_frames; frame++) {
+		uint64_t t0 = SDL_GetPerformanceCounter();
+
+		spawn_accum += (float)spawn_rate * SIM_DT;
+		for (; spawn_accum >= 1.0f; spawn_accum -= 1.0f) {
+			uint32_t ri = rng_uint32(&rng);
+			zombie_director_spawn(&zd, 270 + (int)(ri % 120), 75 + (ri >> 8) % 30, (ri >> 16) % 10);
+		}
+		zombie_director_update(&zd, &piano_roll, SIM_DT, &gx);
+		uint64_t t1 = SDL_GetPerformanceCounter();
+		giblet_exploder_update(&gx, SIM_DT);
+		uint64_t t2 = SDL_GetPerformanceCounter();
+
+		screen_begin_frame(&screen);
+		giblet_exploder_render_ground(&gx, &screen);
+		uint64_t t3 = SDL_GetPerformanceCounter();
+		zombie_director_render(&zd, &screen, &gx);
+		uint64_t t4 = SDL_GetPerformanceCounter();
+		screen_end_frame(&screen);
+		uint64_t t5 = SDL_GetPerformanceCounter();
+
+		ticks[0] += t1 - t0;
+		ticks[1] += t2 - t1;
+		ticks[2] += t3 - t2;
+		ticks[3] += t4 - t3;
+		ticks[4] += t5 - t4;
+		ticks[5] += t5 - t0;
+		update_ticks += t2 - t0;
+		if (t5 - t0 > worst) worst = t5 - t0;
+
+		if (frame % SIM_HZ == 0 || frame == n_frames) {
+			int n = frame % SIM_HZ == 0 ? SIM_HZ : frame % SIM_HZ;
+			printf("%6d %7d %8d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.1f %9.1f %9.1f\n",
+				frame,
+				zd.n_walkers,
+				gx.n_giblets,
+				(double)ticks[0] * ms / n,
+				(double)ticks[1] * ms / n,
+				(double)ticks[2] * ms / n,
+				(double)ticks[3] * ms / n,
+				(double)ticks[4] * ms / n,
+				(double)worst * ms,
+				(double)(screen.max_cmds * sizeof(*screen.cmds)) / (1 << 20),
+				(double)zombie_director_live_memory(&zd) / (1 << 10),
+				(double)giblet_exploder_live_memory(&gx) / (1 << 10));
+			memset(ticks, 0, sizeof(ticks));
+			worst = 0;
+		}
 	}
+	printf("horde: peak %d giblets, %d overflowed\n", gx.peak_giblets, gx.n_overflowed);
+
+	// what saving and restoring both pools costs where the run ended; the
+	// first save only sizes the buffer
+	struct snapshot snapshot;
+	memset(&snapshot, 0, sizeof(snapshot));
+	zombie_director_save(&zd, &snapshot);
+	giblet_exploder_save(&gx, &snapshot);
+	snapshot.size = 0;
+	uint64_t t0 = SDL_GetPerformanceCounter();
+	zombie_director_save(&zd, &snapshot);
+	giblet_exploder_save(&gx, &snapshot);
+	uint64_t t1 = SDL_GetPerformanceCounter();
+	snapshot.cursor = 0;
+	zombie_director_load(&zd, &snapshot);
+	giblet_exploder_load(&gx, &snapshot);
+	uint64_t t2 = SDL_GetPerformanceCounter();
+	printf("horde: snapshot %.2f MB, save %.0f us, restore %.0f us\n",
+		(double)snapshot.size / (1 << 20),
+		(double)(t1 - t0) * ms * 1000.0,
+		(double)(t2 - t1) * ms * 1000.0);
+	free(snapshot.data);
+
+	zombie_director_free(&zd);
+	giblet_exploder_free(&gx);
+	img_free(&bg_img);
+	screen_free(&screen);
+
+	return (double)update_ticks * ms / n_frames;
 }
 
+// drummer sprite parts; every part but the static one has an active
+// variant half the sheet further down, shown while its control is set
+struct drummer_part {
+	int sx, sy; // source
+	int w, h;
+	int x, y; // relative to the drummer
+	int control;
+};
+
+static const struct drummer_part drummer_parts[] = {
+	{ 13, 96, 21, 7, 14, 28, DRUM_CONTROL_HIHAT }, // histick
+	{ 4, 110, 20, 7, 24, 33, DRUM_CONTROL_OPEN }, // hihat
+	{ 2, 29, 17, 21, 1, 0, DRUM_CONTROL_HEAD }, // head
+	{ 1, 1, 30, 26, 0, 39, DRUM_CONTROL_KICK }, // kick
+	{ 3, 61, 34, 23, 3, 18, DRUM_CONTROL_SNARE }, // snare
+	{ 40, 1, 26, 26, 27, 39, 0 }, // static
+};
+
+#define DRUMMER_PARTS ((int)(sizeof(drummer_parts) / sizeof(drummer_parts[0])))
 
 struct drummer {
 	struct img img;
+	// drummer_parts trimmed to their opaque pixels; [1] is the active variant
+	struct img_rect parts[DRUMMER_PARTS][2];
 	int drum_control;
 	int x;
 	int y;
@@ -1257,22 +4534,32 @@ static void drummer_init(struct drummer* drummer)
 	ASSERT(drummer->img.width == 150);
 	ASSERT(drummer->img.height == 240);
 
+	struct img* img = &drummer->img;
+	int actoff = img->height >> 1;
+	for (int i = 0; i < DRUMMER_PARTS; i++) {
+		const struct drummer_part* part = &drummer_parts[i];
+		drummer->parts[i][0] = img_trim(img, part->sx, part->sy, part->w, part->h);
+		drummer->parts[i][1] = img_trim(img, part->sx, part->sy + (part->control ? actoff : 0), part->w, part->h);
+	}
+
 }
 
 static void drummer_reset(struct drummer* drummer)
 {
 	struct img save = drummer->img;
+	struct img_rect save_parts[DRUMMER_PARTS][2];
+	memcpy(save_parts, drummer->parts, sizeof(save_parts));
 	memset(drummer, 0, sizeof(*drummer));
 	drummer->img = save;
+	memcpy(drummer->parts, save_parts, sizeof(save_parts));
 	drummer->x = 45;
 	drummer->y = 112;
 	drummer->kill_dx = 14;
 	drummer->giblet_owner = -1000;
 }
 
-static void drummer_update(struct drummer* drummer, int drum_control, struct zombie_director* zombie_director, float dt, struct giblet_exploder* gx)
+static void drummer_update(struct drummer* drummer, struct zombie_director* zombie_director, float dt, struct giblet_exploder* gx)
 {
-	drummer->drum_control = drum_control;
 	if (drummer->dead) return;
 
 	drummer->dt_accum += dt;
@@ -1303,47 +4590,41 @@ static void drummer_update(struct drummer* drummer, int drum_control, struct zom
 	}
 }
 
-static void drummer_render(struct drummer* drummer, uint32_t* screen, struct giblet_exploder* gx)
+static uint64_t drummer_hash(struct drummer* drummer, uint64_t h)
 {
-	giblet_exploder_render(gx, screen, drummer->giblet_owner);
-	#if 0
-	// src offset, src dim - draw offset
-	histick 13,96 21x7 - 14,28
-	hihat 4,110 20x7 - 24,33
-	head 2,29 17x21 - 1,0
-	kick 1,1 30x26 - 0,39
-	snare 3,61 34x23 - 3,18
-	static 40,1 26x26 - 27,39
-	#endif
-
-	if (drummer->dead) return;
-
-	struct img* img = &drummer->img;
-	int drum_control = drummer->drum_control;
-
-	int x = drummer->x;
-	int y = drummer->y;
-	int actoff = img->height >> 1;
-	int pain = drummer->gib&1;
-
-	// histick
-	screen_draw_img_pain(screen, img, 13, 96 + ((drum_control & DRUM_CONTROL_HIHAT) ? actoff : 0), x+14, y+28, 21, 7, pain);
-
-	// hihat
-	screen_draw_img_pain(screen, img, 4, 110 + ((drum_control & DRUM_CONTROL_OPEN) ? actoff : 0), x+24, y+33, 20, 7, pain);
+	h = hash_bytes(h, &drummer->dt_accum, sizeof(drummer->dt_accum));
+	h = hash_bytes(h, &drummer->gib, sizeof(drummer->gib));
+	return hash_bytes(h, &drummer->dead, sizeof(drummer->dead));
+}
 
-	// head
-	screen_draw_img_pain(screen, img, 2, 29 + ((drum_control & DRUM_CONTROL_HEAD) ? actoff : 0), x+1, y+0, 17, 21, pain);
+static void drummer_save(struct drummer* drummer, struct snapshot* s)
+{
+	SNAPSHOT_PUT(s, drummer->drum_control);
+	SNAPSHOT_PUT(s, drummer->dt_accum);
+	SNAPSHOT_PUT(s, drummer->gib);
+	SNAPSHOT_PUT(s, drummer->dead);
+}
 
-	// kick
-	screen_draw_img_pain(screen, img, 1, 1 + ((drum_control & DRUM_CONTROL_KICK) ? actoff : 0), x+0, y+39, 30, 26, pain);
+static void drummer_load(struct drummer* drummer, struct snapshot* s)
+{
+	SNAPSHOT_GET(s, drummer->drum_control);
+	SNAPSHOT_GET(s, drummer->dt_accum);
+	SNAPSHOT_GET(s, drummer->gib);
+	SNAPSHOT_GET(s, drummer->dead);
+}
 
-	// snare
-	screen_draw_img_pain(screen, img, 3, 61 + ((drum_control & DRUM_CONTROL_SNARE) ? actoff : 0), x+3, y+18, 34, 23, pain);
+static void drummer_render(struct drummer* drummer, struct screen* screen, struct giblet_exploder* gx)
+{
+	giblet_exploder_render(gx, screen, drummer->giblet_owner);
 
-	// static
-	screen_draw_img_pain(screen, img, 40, 1, x+27, y+39, 26, 26, pain);
+	if (drummer->dead) return;
 
+	int pain = drummer->gib&1;
+	for (int i = 0; i < DRUMMER_PARTS; i++) {
+		const struct drummer_part* part = &drummer_parts[i];
+		struct img_rect* r = &drummer->parts[i][(drummer->drum_control & part->control) ? 1 : 0];
+		screen_draw_img_pain(screen, &drummer->img, r->x, r->y, drummer->x + part->x + r->dx, drummer->y + part->y + r->dy, r->w, r->h, pain);
+	}
 }
 
 
@@ -1369,6 +4650,7 @@ static void player_init(struct player* player, const char* asset, int width, int
 	img_load(&player->img, asset);
 	ASSERT(player->img.width == width);
 	ASSERT(player->img.height == height);
+	img_set_cells(&player->img, width, anim_offset);
 	player->width = width;
 	player->height = height;
 	player->x = x;
@@ -1422,7 +4704,28 @@ static void player_update(struct player* p, struct zombie_director* zombie_direc
 	}
 }
 
-static void player_render(struct player* player, uint32_t* screen, int step, struct giblet_exploder* gx)
+static uint64_t player_hash(struct player* p, uint64_t h)
+{
+	h = hash_bytes(h, &p->dt_accum, sizeof(p->dt_accum));
+	h = hash_bytes(h, &p->gib, sizeof(p->gib));
+	return hash_bytes(h, &p->dead, sizeof(p->dead));
+}
+
+static void player_save(struct player* p, struct snapshot* s)
+{
+	SNAPSHOT_PUT(s, p->gib);
+	SNAPSHOT_PUT(s, p->dead);
+	SNAPSHOT_PUT(s, p->dt_accum);
+}
+
+static void player_load(struct player* p, struct snapshot* s)
+{
+	SNAPSHOT_GET(s, p->gib);
+	SNAPSHOT_GET(s, p->dead);
+	SNAPSHOT_GET(s, p->dt_accum);
+}
+
+static void player_render(struct player* player, struct screen* screen, int step, struct giblet_exploder* gx)
 {
 	giblet_exploder_render(gx, screen, player->giblet_owner);
 
@@ -1442,9 +4745,239 @@ static void player_render(struct player* player, uint32_t* screen, int step, str
 		pain);
 }
 
+// the seeds a round starts from: recorded when recording, and put back
+// in place of the resets' when playing back
+static void replay_seed_round(struct replay* r, struct audio* audio, struct giblet_exploder* gx, struct zombie_director* zd)
+{
+	if (r->recording) {
+		r->seeds[REPLAY_SEED_AUDIO] = AUDIO_RNG_SEED;
+		r->seeds[REPLAY_SEED_GIBLETS] = GIBLET_RNG_SEED;
+		r->seeds[REPLAY_SEED_ZOMBIES] = ZOMBIE_RNG_SEED;
+	}
+	rng_seed(&audio->rng, r->seeds[REPLAY_SEED_AUDIO]);
+	rng_seed(&gx->rng, r->seeds[REPLAY_SEED_GIBLETS]);
+	rng_seed(&zd->rng, r->seeds[REPLAY_SEED_ZOMBIES]);
+}
+
+// everything a round's state lives in
+struct game {
+	struct audio* audio;
+	struct piano_roll* piano_roll;
+	struct zombie_director* zombie_director;
+	struct giblet_exploder* giblet_exploder;
+	struct drummer* drummer;
+	struct player* bass_player;
+	struct player* guitar_player;
+	uint64_t* sim_ticks;
+};
+
+static uint64_t game_state_hash(struct game* game)
+{
+	uint64_t h = HASH_INIT;
+	h = piano_roll_hash(game->piano_roll, h);
+	h = zombie_director_hash(game->zombie_director, h);
+	h = giblet_exploder_hash(game->giblet_exploder, h);
+	h = drummer_hash(game->drummer, h);
+	h = player_hash(game->bass_player, h);
+	return player_hash(game->guitar_player, h);
+}
+
+static void game_save(struct game* game, struct snapshot* s)
+{
+	s->size = 0;
+	SNAPSHOT_PUT(s, *game->sim_ticks);
+	audio_save(game->audio, s);
+	piano_roll_save(game->piano_roll, s);
+	zombie_director_save(game->zombie_director, s);
+	giblet_exploder_save(game->giblet_exploder, s);
+	drummer_save(game->drummer, s);
+	player_save(game->bass_player, s);
+	player_save(game->guitar_player, s);
+}
+
+// the audio has to be started; drum control feedback from before the
+// restore is still in the ring, so skip to its cursor afterwards
+static void game_load(struct game* game, struct snapshot* s)
+{
+	s->cursor = 0;
+	SNAPSHOT_GET(s, *game->sim_ticks);
+	audio_load(game->audio, s);
+	piano_roll_load(game->piano_roll, s);
+	zombie_director_load(game->zombie_director, s);
+	giblet_exploder_load(game->giblet_exploder, s);
+	drummer_load(game->drummer, s);
+	player_load(game->bass_player, s);
+	player_load(game->guitar_player, s);
+	ASSERT(s->cursor == s->size);
+}
+
+#define SNAPSHOT_MAGIC "dotdsnap"
+// bump whenever anything game_save() writes changes layout
+#define SNAPSHOT_VERSION (1)
+
+static void snapshot_write(struct snapshot* s, const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "%s: could not write snapshot\n", path);
+		return;
+	}
+	uint64_t size = s->size;
+	uint32_t version = SNAPSHOT_VERSION;
+	fwrite(SNAPSHOT_MAGIC, 1, 8, f);
+	fwrite(&version, sizeof(version), 1, f);
+	fwrite(&size, sizeof(size), 1, f);
+	fwrite(s->data, 1, s->size, f);
+	fclose(f);
+}
+
+static void snapshot_read(struct snapshot* s, const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) arghf("cannot open snapshot %s\n", path);
+	char magic[8];
+	uint32_t version;
+	uint64_t size;
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0) arghf("%s: not a snapshot\n", path);
+	if (fread(&version, sizeof(version), 1, f) != 1) arghf("%s: truncated snapshot\n", path);
+	if (version != SNAPSHOT_VERSION) arghf("%s: snapshot version %u, this build reads %d\n", path, version, SNAPSHOT_VERSION);
+	if (fread(&size, sizeof(size), 1, f) != 1) arghf("%s: truncated snapshot\n", path);
+	s->size = 0;
+	uint8_t* data = malloc(size);
+	AN(data);
+	if (fread(data, 1, size, f) != size) arghf("%s: truncated snapshot\n", path);
+	snapshot_put(s, data, size);
+	free(data);
+	fclose(f);
+}
+
 int main(int argc, char** argv)
 {
-	SAZ(SDL_Init(SDL_INIT_EVERYTHING));
+	int render_threads = SDL_GetCPUCount();
+	int render_scale = 1;
+	int bench_render = 0;
+	int vsync = 1;
+	int frame_times = 0;
+	int profile_overlay = 0;
+	const char* profile_csv = NULL;
+	const char* trace_path = NULL;
+	int zero_copy = 0;
+	int cpu_upscale = -1; // -1: only with the software renderer
+	int bench_upscale_only = 0;
+	int bench_giblets_only = 0;
+	int bench_giblet_physics_only = 0;
+	int bench_zombies_only = 0;
+	int bench_horde_only = 0;
+	int bench_horde_scaling = 0;
+	int horde_spawn_rate = 2000;
+	int max_giblets = 0; // 0: the default, which the horde raises
+	int max_zombies = 0;
+	enum giblet_overflow giblet_overflow = GIBLET_OVERFLOW_SPILL;
+	struct cpu_upscaler cpu_upscaler;
+	memset(&cpu_upscaler, 0, sizeof(cpu_upscaler));
+	struct present_layout present_layout;
+	memset(&present_layout, 0, sizeof(present_layout));
+	struct headless headless;
+	memset(&headless, 0, sizeof(headless));
+	headless.fps = 60;
+	const char* record_path = NULL;
+	struct replay replay;
+	memset(&replay, 0, sizeof(replay));
+	const char* desync_snapshot_path = NULL;
+	const char* replay_from_path = NULL;
+	float practice_from = 0;
+	float practice_to = 0; // 0: no practice loop
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--render-threads") == 0 && (i+1) < argc) {
+			render_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--render-scale") == 0 && (i+1) < argc) {
+			render_scale = atoi(argv[++i]);
+			if (render_scale < 1) render_scale = 1;
+		} else if (strcmp(argv[i], "--bench-render") == 0) {
+			bench_render = 1;
+		} else if (strcmp(argv[i], "--integer-scale") == 0) {
+			present_layout.integer_scale = 1;
+		} else if (strcmp(argv[i], "--zero-copy") == 0) {
+			zero_copy = 1;
+		} else if (strcmp(argv[i], "--cpu-upscale") == 0) {
+			cpu_upscale = 1;
+		} else if (strcmp(argv[i], "--no-cpu-upscale") == 0) {
+			cpu_upscale = 0;
+		} else if (strcmp(argv[i], "--bench-upscale") == 0) {
+			bench_upscale_only = 1;
+		} else if (strcmp(argv[i], "--bench-giblets") == 0) {
+			bench_giblets_only = 1;
+		} else if (strcmp(argv[i], "--bench-giblet-physics") == 0) {
+			bench_giblet_physics_only = 1;
+		} else if (strcmp(argv[i], "--bench-zombies") == 0) {
+			bench_zombies_only = 1;
+		} else if (strcmp(argv[i], "--bench-horde") == 0) {
+			bench_horde_only = 1;
+		} else if (strcmp(argv[i], "--bench-horde-scaling") == 0) {
+			bench_horde_only = 1;
+			bench_horde_scaling = 1;
+		} else if (strcmp(argv[i], "--horde-spawn-rate") == 0 && (i+1) < argc) {
+			horde_spawn_rate = atoi(argv[++i]);
+			if (horde_spawn_rate < 0) horde_spawn_rate = 0;
+		} else if (strcmp(argv[i], "--max-zombies") == 0 && (i+1) < argc) {
+			max_zombies = atoi(argv[++i]);
+			if (max_zombies < 1) max_zombies = 1;
+		} else if (strcmp(argv[i], "--max-giblets") == 0 && (i+1) < argc) {
+			max_giblets = atoi(argv[++i]);
+			if (max_giblets < 1) max_giblets = 1;
+		} else if (strcmp(argv[i], "--giblet-overflow") == 0 && (i+1) < argc) {
+			const char* policy = argv[++i];
+			if (strcmp(policy, "spill") == 0) {
+				giblet_overflow = GIBLET_OVERFLOW_SPILL;
+			} else if (strcmp(policy, "drop") == 0) {
+				giblet_overflow = GIBLET_OVERFLOW_DROP;
+			} else {
+				fprintf(stderr, "ignoring unknown giblet overflow policy %s\n", policy);
+			}
+		} else if (strcmp(argv[i], "--frame-times") == 0) {
+			frame_times = 1;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			profile_overlay = 1;
+		} else if (strcmp(argv[i], "--profile-csv") == 0 && (i+1) < argc) {
+			profile_csv = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && (i+1) < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--no-vsync") == 0) {
+			vsync = 0;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless.enabled = 1;
+		} else if (strcmp(argv[i], "--script") == 0 && (i+1) < argc) {
+			headless_load_script(&headless, argv[++i]);
+		} else if (strcmp(argv[i], "--fps") == 0 && (i+1) < argc) {
+			headless.fps = atoi(argv[++i]);
+			if (headless.fps < 1) headless.fps = 1;
+		} else if (strcmp(argv[i], "--frames") == 0 && (i+1) < argc) {
+			headless.max_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--dump-frames") == 0 && (i+1) < argc) {
+			headless_parse_dump_frames(&headless, argv[++i]);
+		} else if (strcmp(argv[i], "--dump-dir") == 0 && (i+1) < argc) {
+			headless.dump_dir = argv[++i];
+		} else if (strcmp(argv[i], "--golden-dir") == 0 && (i+1) < argc) {
+			headless.golden_dir = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && (i+1) < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && (i+1) < argc) {
+			replay_load(&replay, argv[++i]);
+		} else if (strcmp(argv[i], "--desync-snapshot") == 0 && (i+1) < argc) {
+			desync_snapshot_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay-from") == 0 && (i+1) < argc) {
+			replay_from_path = argv[++i];
+		} else if (strcmp(argv[i], "--practice") == 0 && (i+1) < argc) {
+			if (sscanf(argv[++i], "%f:%f", &practice_from, &practice_to) != 2 || practice_to <= practice_from) {
+				fprintf(stderr, "ignoring practice section %s; want FROM:TO in seconds\n", argv[i]);
+				practice_to = 0;
+			}
+		} else {
+			fprintf(stderr, "ignoring unknown argument %s\n", argv[i]);
+		}
+	}
+
+	SAZ(SDL_Init(headless.enabled ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING));
 	atexit(SDL_Quit);
 
 	{
@@ -1458,46 +4991,119 @@ int main(int argc, char** argv)
 		}
 	}
 
+	if (bench_upscale_only) {
+		struct render_pool pool;
+		render_pool_init(&pool, render_threads);
+		bench_upscale(&pool);
+		render_pool_quit(&pool);
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_giblets_only) {
+		bench_giblets();
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_giblet_physics_only) {
+		bench_giblet_physics();
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_zombies_only) {
+		bench_zombies();
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_horde_only) {
+		// --bench-horde-scaling: the same horde once per pool size, with
+		// a summary of how the update jobs scale at the end
+		const int n_horde = bench_horde_scaling ? BENCH_POOLS : 1;
+		double horde_ms[BENCH_POOLS];
+		for (int i = 0; i < n_horde; i++) {
+			struct render_pool pool;
+			render_pool_init(&pool, bench_horde_scaling ? bench_pool_threads[i] : render_threads);
+			horde_ms[i] = bench_horde(
+				&pool,
+				max_zombies > 0 ? max_zombies : 10000,
+				max_giblets > 0 ? max_giblets : 1 << 20,
+				horde_spawn_rate,
+				headless.max_frames > 0 ? headless.max_frames : SIM_HZ * 20);
+			render_pool_quit(&pool);
+		}
+		if (bench_horde_scaling) {
+			printf("horde zombie+giblet update:\n");
+			for (int i = 0; i < n_horde; i++) {
+				printf("  %d thread(s): %.3f ms/frame (%.2fx)\n", bench_pool_threads[i], horde_ms[i], horde_ms[0] / horde_ms[i]);
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (max_zombies == 0) max_zombies = MAX_ZOMBIES;
+	if (max_giblets == 0) max_giblets = MAX_GIBLETS;
+
+	SDL_Window* window = NULL;
+	SDL_Renderer* renderer = NULL;
+	SDL_Texture* texture = NULL;
+
+	if (!headless.enabled) {
 	#if 1
-	SDL_Window* window = SDL_CreateWindow(
-			"Drums of the Dead",
-			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-			0, 0,
-			SDL_WINDOW_FULLSCREEN_DESKTOP);
+		window = SDL_CreateWindow(
+				"Drums of the Dead",
+				SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+				0, 0,
+				SDL_WINDOW_FULLSCREEN_DESKTOP | SDL_WINDOW_ALLOW_HIGHDPI);
 	#else
-	SDL_Window* window = SDL_CreateWindow(
-			"Drums of the Dead",
-			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-			500, 1000,
-			0);
+		window = SDL_CreateWindow(
+				"Drums of the Dead",
+				SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+				500, 1000,
+				SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
 	#endif
-	SAN(window);
-
-	SDL_DisplayMode mode;
-	SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode);
-
-	int refresh_rate = mode.refresh_rate;
-	if (!refresh_rate) refresh_rate = 60; // #pray
+		SAN(window);
+
+		renderer = SDL_CreateRenderer(
+				window,
+				-1, 
+				SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+		if (renderer == NULL) {
+			renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+		}
+		SAN(renderer);
+
+		SDL_RendererInfo renderer_info;
+		SAZ(SDL_GetRendererInfo(renderer, &renderer_info));
+		if (cpu_upscale == -1) cpu_upscale = (renderer_info.flags & SDL_RENDERER_SOFTWARE) != 0;
+		if (cpu_upscale) {
+			present_layout.integer_scale = 1;
+			zero_copy = 0;
+		}
 
-	SDL_Renderer* renderer = SDL_CreateRenderer(
-			window,
-			-1, 
-			SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-	SAN(renderer);
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_ADD);
 
-	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_ADD);
 
+		texture = SDL_CreateTexture(
+				renderer,
+				SDL_PIXELFORMAT_ABGR8888,
+				SDL_TEXTUREACCESS_STREAMING,
+				SCREEN_WIDTH * render_scale,
+				SCREEN_HEIGHT * render_scale);
+		SAN(texture);
 
-	SDL_Texture* texture = SDL_CreateTexture(
-			renderer,
-			SDL_PIXELFORMAT_ABGR8888,
-			SDL_TEXTUREACCESS_STREAMING,
-			SCREEN_WIDTH,
-			SCREEN_HEIGHT);
-	SAN(texture);
+		if (zero_copy && !texture_lock_retains_pixels(texture)) {
+			fprintf(stderr, "texture memory isn't retained between locks; using the copy path\n");
+			zero_copy = 0;
+		}
+	}
 
 	struct audio audio;
-	audio_init(&audio);
+	audio_init(&audio, headless.enabled);
+	if (replay.playing) {
+		audio.replay = &replay;
+	} else if (record_path != NULL) {
+		replay.recording = 1;
+	}
+	int replay_started = 0;
 
 	struct piano_roll piano_roll;
 	piano_roll_init(&piano_roll, &song_data_song);
@@ -1526,7 +5132,8 @@ int main(int argc, char** argv)
 	ASSERT(bg_img.height == SCREEN_HEIGHT);
 
 	struct giblet_exploder giblet_exploder;
-	giblet_exploder_init(&giblet_exploder);
+	giblet_exploder_init(&giblet_exploder, &bg_img, max_giblets);
+	giblet_exploder.overflow = giblet_overflow;
 
 	struct drummer drummer;
 	drummer_init(&drummer);
@@ -1554,24 +5161,96 @@ int main(int argc, char** argv)
 		-2);
 
 	struct zombie_director zombie_director;
-	zombie_director_init(&zombie_director);
+	zombie_director_init(&zombie_director, max_zombies);
 
 	int drum_control_cooldown[DRUM_ID_MAX] = {0};
+	uint64_t sim_ticks = 0;
+
+	struct game game;
+	game.audio = &audio;
+	game.piano_roll = &piano_roll;
+	game.zombie_director = &zombie_director;
+	game.giblet_exploder = &giblet_exploder;
+	game.drummer = &drummer;
+	game.bass_player = &bass_player;
+	game.guitar_player = &guitar_player;
+	game.sim_ticks = &sim_ticks;
+
+	// taken the first time a round starts, and restored in place of the
+	// resets on every (re)start after that
+	struct snapshot round_start;
+	memset(&round_start, 0, sizeof(round_start));
+	// --practice: taken when the section starts, restored when it ends
+	struct snapshot practice;
+	memset(&practice, 0, sizeof(practice));
+	int practice_saved = 0;
+	if (practice_to > 0 && (replay.recording || replay.playing)) {
+		fprintf(stderr, "practice loops can't be recorded or replayed; ignoring --practice\n");
+		practice_to = 0;
+	}
+	// --desync-snapshot: the last second of a replay that matched
+	struct snapshot last_good;
+	memset(&last_good, 0, sizeof(last_good));
+	// --replay-from: where to start playing back from
+	struct snapshot replay_from;
+	memset(&replay_from, 0, sizeof(replay_from));
+	if (replay_from_path != NULL) {
+		if (!replay.playing) arghf("--replay-from needs --replay\n");
+		snapshot_read(&replay_from, replay_from_path);
+	}
 
 	struct img menu_img;
 	img_load(&menu_img, "menu.png");
 	ASSERT(menu_img.width == SCREEN_WIDTH);
 	ASSERT(menu_img.height == SCREEN_HEIGHT);
 
-	uint32_t* screen = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
-	AN(screen);
+	struct screen screen;
+	screen_init(&screen, render_scale);
+
+	struct render_pool render_pool;
+	render_pool_init(&render_pool, render_threads);
+	screen.pool = &render_pool;
+	giblet_exploder.pool = &render_pool;
+	zombie_director.pool = &render_pool;
+
+	// --bench-render: rasterize every gameplay frame once per pool size and
+	// print how the band split scales at exit
+	struct render_pool bench_pools[BENCH_POOLS];
+	uint64_t bench_ticks[BENCH_POOLS];
+	int bench_frames = 0;
+	if (bench_render) {
+		for (int i = 0; i < BENCH_POOLS; i++) {
+			render_pool_init(&bench_pools[i], bench_pool_threads[i]);
+			bench_ticks[i] = 0;
+		}
+	}
 
 	int exiting = 0;
 	int menu = 1;
 	int menu_selection = 0;
 	int audio_buffer_length_exp = 1;
+	struct profiler profiler;
+	profiler_init(&profiler, profile_csv != NULL);
+	profiler.overlay = profile_overlay;
+
+	struct tracer tracer;
+	if (trace_path != NULL) {
+		tracer_init(&tracer);
+		profiler.trace = tracer_add_buffer(&tracer, "main", 1<<16, 1);
+		audio.trace = tracer_add_buffer(&tracer, "audio", 1<<18, 0);
+		render_pool_trace(&render_pool, &tracer, profiler.trace);
+	}
+
+	headless.t0 = SDL_GetPerformanceCounter();
+	uint64_t frame_ticks = 0;
+	uint64_t present_ticks = 0;
+	int n_frames = 0;
 	while (!exiting) {
-		//uint64_t t0 = SDL_GetPerformanceCounter();
+		uint64_t t0 = SDL_GetPerformanceCounter();
+		PROF_BEGIN(&profiler, PROF_FRAME);
+
+		screen_begin_frame(&screen);
+		font_begin_frame(&font);
 		
 		if (menu) {
 			SDL_Event e;
@@ -1579,8 +5258,16 @@ int main(int argc, char** argv)
 			int pressed_char = 0;
 			int menu_length = 7;
 			int d = 0;
-			while (SDL_PollEvent(&e)) {
+			if (replay.playing) {
+				// replays start straight away, and it's only the one round
+				if (replay_started) exiting = 1;
+				menu_selection = 0;
+				select = 1;
+				replay_started = 1;
+			}
+			while (poll_event(&headless, &e)) {
 				if (e.type == SDL_QUIT) exiting = 1;
+				if (present_layout_event(&e)) present_layout_invalidate(&present_layout);
 				if (e.type == SDL_KEYDOWN) {
 					if (e.key.keysym.sym == SDLK_ESCAPE) {
 						exiting = 1;
@@ -1609,13 +5296,40 @@ int main(int argc, char** argv)
 				case 0:
 					if (select) {
 						menu = 0;
-						drummer_reset(&drummer);
-						player_reset(&bass_player);
-						player_reset(&guitar_player);
-						zombie_director_reset(&zombie_director);
-						piano_roll_reset(&piano_roll);
-						giblet_exploder_reset(&giblet_exploder);
-						audio_start(&audio, audio_buffer_length_exp);
+						if (replay.recording) replay_clear(&replay, audio_buffer_length_exp);
+						if (replay.playing) {
+							replay_rewind(&replay);
+							audio_buffer_length_exp = replay.audio_buffer_length_exp;
+						}
+						if (round_start.size == 0) {
+							drummer_reset(&drummer);
+							player_reset(&bass_player);
+							player_reset(&guitar_player);
+							zombie_director_reset(&zombie_director);
+							piano_roll_reset(&piano_roll);
+							giblet_exploder_reset(&giblet_exploder);
+							if (replay.recording || replay.playing) {
+								replay_seed_round(&replay, &audio, &giblet_exploder, &zombie_director);
+							}
+							sim_ticks = 0;
+							audio_start(&audio, audio_buffer_length_exp);
+							game_save(&game, &round_start);
+						} else {
+							audio_start(&audio, audio_buffer_length_exp);
+							game_load(&game, &round_start);
+						}
+						if (replay.recording) replay.sample_rate = audio.sample_rate;
+						if (replay.playing && replay.sample_rate != audio.sample_rate) {
+							fprintf(stderr, "replay: recorded at %u Hz, playing at %u Hz; it won't match\n", replay.sample_rate, audio.sample_rate);
+						}
+						if (replay_from.size > 0) {
+							game_load(&game, &replay_from);
+							replay_seek_skips(&replay, sim_ticks);
+						}
+						audio_lock(&audio);
+						feedback_cursor = audio.drum_control_feedback_cursor;
+						audio_unlock(&audio);
+						practice_saved = 0;
 					}
 					break;
 				case 5:
@@ -1635,61 +5349,66 @@ int main(int argc, char** argv)
 			}
 
 
-			memcpy(screen, menu_img.data, sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+			screen_draw_img_opaque(&screen, &menu_img, 0, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
 			uint32_t select_color = mkcol(255,255,255);
 			uint32_t unselect_color = mkcol(128,128,128);
 
 			font_set_color(&font, menu_selection == 0 ? select_color : unselect_color);
 			font_set_cursor(&font, 120, 100);
-			font_printf(&font, screen, "start game\n");
-
-			const char* drum_names[] = {
-				"kick",
-				"snare",
-				"hihat",
-				"open"
-			};
+			font_printf(&font, &screen, "start game\n");
 
 			for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
 				font_set_color(&font, menu_selection == (1+drum_id) ? select_color : unselect_color);
-				font_printf(&font, screen, "%s keys: ", drum_names[drum_id]);
+				font_printf(&font, &screen, "%s keys: ", drum_names[drum_id]);
 				for (int c = 32; c < 128; c++) {
 					if (drum_control_keymap[c] & (1<<drum_id)) {
-						font_printf(&font, screen, "%c", c);
+						font_printf(&font, &screen, "%c", c);
 					}
 				}
-				font_printf(&font, screen, "\n");
+				font_printf(&font, &screen, "\n");
 			}
 
 			font_set_color(&font, menu_selection == 5 ? select_color : unselect_color);
-			font_printf(&font, screen, "audio buffer length: %d\n", 256 << audio_buffer_length_exp);
+			font_printf(&font, &screen, "audio buffer length: %d\n", 256 << audio_buffer_length_exp);
 			font_set_color(&font, menu_selection == 6 ? select_color : unselect_color);
-			font_printf(&font, screen, "quit to dos");
+			font_printf(&font, &screen, "quit to dos");
 
 			font_set_color(&font, mkcol(255,200,150));
 			font_set_cursor(&font, 30, 70);
-			font_printf(&font, screen, "your last gig sucked so much that you raised the dead\n");
+			font_printf(&font, &screen, "your last gig sucked so much that you raised the dead\n");
 			font_set_color(&font, mkcol(255,255,255));
 			font_set_cursor(&font, 1, 80);
-			font_printf(&font, screen, "now play some awesome drums or else the zombies will devour you!");
+			font_printf(&font, &screen, "now play some awesome drums or else the zombies will devour you!");
 		} else {
 			SDL_Event e;
 			uint32_t drum_control = 0;
-			while (SDL_PollEvent(&e)) {
+			struct snapshot* restore = NULL;
+			PROF_BEGIN(&profiler, PROF_INPUT);
+			while (poll_event(&headless, &e)) {
 				if (e.type == SDL_QUIT) exiting = 1;
+				if (present_layout_event(&e)) present_layout_invalidate(&present_layout);
 				if (e.type == SDL_KEYDOWN) {
 					if (e.key.keysym.sym == SDLK_ESCAPE) {
 						menu = 1;
 						audio_stop(&audio);
+#ifndef NO_PROFILER
+					} else if (e.key.keysym.sym == SDLK_F3) {
+						profiler.overlay = !profiler.overlay;
+#endif
+					} else if (e.key.keysym.sym == SDLK_F5 && !replay.playing) {
+						// instant restart
+						restore = &round_start;
 					}
+					TRACE_INSTANT(profiler.trace, "key down");
 
 					int k = e.key.keysym.sym;
-					if (k >= 32 && k < 128) {
+					if (k >= 32 && k < 128 && !replay.playing) {
 						drum_control |= drum_control_keymap[k];
 					}
 				}
 			}
+			PROF_END(&profiler, PROF_INPUT);
 
 			uint32_t audio_position;
 
@@ -1697,16 +5416,22 @@ int main(int argc, char** argv)
 				drum_control = 0;
 			}
 
+			PROF_BEGIN(&profiler, PROF_AUDIO_LOCK);
 			audio_lock(&audio);
 			{
 				audio_position = audio.position;
+				uint32_t played = 0;
 				while (feedback_cursor != audio.drum_control_feedback_cursor) {
 					struct drum_control_feedback* fb = &audio.drum_control_feedback[feedback_cursor];
 					if (fb->value) {
-						piano_roll_register_drum_control_feedback(&piano_roll, &audio, fb);
+						piano_roll_queue_drum_control_feedback(&piano_roll, fb);
+						if (replay.recording) replay_record_drum_control(&replay, fb);
+						played |= fb->value;
 					}
 					feedback_cursor = (feedback_cursor + 1) & DRUM_CONTROL_FEEDBACK_MASK;
 				}
+				// the drummer plays along with the replay
+				if (replay.playing) drum_control = played;
 				audio_emit_drum_control(&audio, drum_control);
 
 				// handle player death
@@ -1714,70 +5439,265 @@ int main(int argc, char** argv)
 				if (guitar_player.dead) audio.guitar_stopped = 1;
 			}
 			audio_unlock(&audio);
+			PROF_END(&profiler, PROF_AUDIO_LOCK);
 
-
-			memset(screen, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+			if (practice_saved && audio_position >= (uint32_t)(practice_to * (float)audio.sample_rate)) {
+				restore = &practice;
+			}
+			if (restore != NULL) {
+				if (restore == &round_start) {
+					if (replay.recording) {
+						replay_clear(&replay, audio_buffer_length_exp);
+						replay.sample_rate = audio.sample_rate;
+					}
+					practice_saved = 0;
+				}
+				game_load(&game, restore);
+				audio_lock(&audio);
+				audio_position = audio.position;
+				feedback_cursor = audio.drum_control_feedback_cursor;
+				audio_unlock(&audio);
+				memset(drum_control_cooldown, 0, sizeof(drum_control_cooldown));
+			}
 
 
-			uint32_t cool_drum_control = 0;
 			for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
 				int mask = 1<<drum_id;
 				if (drum_control & mask) {
-					int cooldown = drum_id == DRUM_ID_OPEN ? refresh_rate * 2 : refresh_rate / 10;
+					int cooldown = drum_id == DRUM_ID_OPEN ? SIM_HZ * 2 : SIM_HZ / 10;
 					drum_control_cooldown[drum_id] = cooldown;
 					// open/close hihack
 					if (drum_id == DRUM_ID_HIHAT) drum_control_cooldown[DRUM_ID_OPEN] = 0;
 				}
-				if (drum_control_cooldown[drum_id] > 0) {
-					cool_drum_control |= mask;
-					drum_control_cooldown[drum_id]--;
-				}
 			}
 
 			int step = (int)((audio_position_to_seconds(&audio, audio_position) * (float)piano_roll.song->bpm * (float)piano_roll.song->lpb) / 60.0);
 
 			int song_end = step > piano_roll.song->length;
 
-			if (step & 4 && !song_end) {
-				cool_drum_control |= DRUM_CONTROL_HEAD;
+			// the simulation runs at a fixed SIM_HZ paced by the audio
+			// clock, independent of how often we render; if we fall way
+			// behind (stalls) the backlog is dropped rather than replayed
+			// (except when playing back, where it's dropped where the
+			// recording dropped it)
+			uint64_t sim_target = ((uint64_t)audio_position * SIM_HZ) / audio.sample_rate;
+			if (!replay.playing && sim_target > sim_ticks + SIM_MAX_STEPS_PER_FRAME) {
+				if (replay.recording) replay_record_skip(&replay, sim_ticks, sim_target - SIM_MAX_STEPS_PER_FRAME);
+				sim_ticks = sim_target - SIM_MAX_STEPS_PER_FRAME;
+			}
+			while (sim_ticks < sim_target) {
+				if (replay.playing && replay_skip(&replay, &sim_ticks)) continue;
+				PROF_BEGIN(&profiler, PROF_PIANO_ROLL);
+				piano_roll_advance(&piano_roll, &audio, (uint32_t)((sim_ticks * audio.sample_rate) / SIM_HZ));
+				PROF_END(&profiler, PROF_PIANO_ROLL);
+				PROF_BEGIN(&profiler, PROF_ZOMBIES);
+				zombie_director_update(&zombie_director, &piano_roll, SIM_DT, &giblet_exploder);
+				PROF_END(&profiler, PROF_ZOMBIES);
+				PROF_BEGIN(&profiler, PROF_DRUMMER);
+				drummer_update(&drummer, &zombie_director, SIM_DT, &giblet_exploder);
+				PROF_END(&profiler, PROF_DRUMMER);
+				PROF_BEGIN(&profiler, PROF_PLAYERS);
+				player_update(&bass_player, &zombie_director, SIM_DT, &giblet_exploder);
+				player_update(&guitar_player, &zombie_director, SIM_DT, &giblet_exploder);
+				PROF_END(&profiler, PROF_PLAYERS);
+				PROF_BEGIN(&profiler, PROF_GIBLETS);
+				giblet_exploder_update(&giblet_exploder, SIM_DT);
+				PROF_END(&profiler, PROF_GIBLETS);
+				for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
+					if (drum_control_cooldown[drum_id] > 0) drum_control_cooldown[drum_id]--;
+				}
+				sim_ticks++;
+				if ((replay.recording || replay.playing) && (sim_ticks % SIM_HZ) == 0) {
+					int hash_failures = replay.hash_failures;
+					replay_hash_second(&replay, sim_ticks / SIM_HZ, game_state_hash(&game));
+					if (replay.playing && desync_snapshot_path != NULL) {
+						if (replay.hash_failures == 0) {
+							game_save(&game, &last_good);
+						} else if (hash_failures == 0 && last_good.size > 0) {
+							snapshot_write(&last_good, desync_snapshot_path);
+							fprintf(stderr, "replay: wrote the last second that matched to %s\n", desync_snapshot_path);
+						}
+					}
+				}
+				if (practice_to > 0 && !practice_saved && sim_ticks >= (uint64_t)(practice_from * SIM_HZ)) {
+					game_save(&game, &practice);
+					practice_saved = 1;
+				}
 			}
-
 			piano_roll_update_position(&piano_roll, &audio, audio_position);
-			piano_roll_update_gauge(&piano_roll);
-
-			float dt = 1.0f / (float)refresh_rate;
 
-			zombie_director_update(&zombie_director, &piano_roll, dt, &giblet_exploder);
-			drummer_update(&drummer, cool_drum_control, &zombie_director, dt, &giblet_exploder);
-			player_update(&bass_player, &zombie_director, dt, &giblet_exploder);
-			player_update(&guitar_player, &zombie_director, dt, &giblet_exploder);
-			giblet_exploder_update(&giblet_exploder, dt);
+			if (replay.recording) replay.end_position = audio_position;
+			if (replay.playing && audio_position >= replay.end_position) exiting = 1;
 
-			memcpy(screen, bg_img.data, SCREEN_WIDTH*SCREEN_HEIGHT*sizeof(uint32_t));
+			// how far we are into the next simulation step. only giblets
+			// are interpolated: zombies walk by sprite frame and their x
+			// jumps a whole cycle on wrap, the players don't move, and the
+			// piano roll follows audio_position itself
+			giblet_exploder.alpha = (float)(((uint64_t)audio_position * SIM_HZ) % audio.sample_rate) / (float)audio.sample_rate;
 
-			giblet_exploder_render(&giblet_exploder, screen, 0);
-			drummer_render(&drummer, screen, &giblet_exploder);
-			player_render(&bass_player, screen, song_end ? 0 : step, &giblet_exploder);
-			player_render(&guitar_player, screen, song_end ? 0 : step, &giblet_exploder);
+			uint32_t cool_drum_control = 0;
+			for (int drum_id = 0; drum_id < DRUM_ID_MAX; drum_id++) {
+				if (drum_control_cooldown[drum_id] > 0) cool_drum_control |= 1<<drum_id;
+			}
+			if (step & 4 && !song_end) {
+				cool_drum_control |= DRUM_CONTROL_HEAD;
+			}
+			drummer.drum_control = cool_drum_control;
+
+			PROF_BEGIN(&profiler, PROF_RENDER_GROUND);
+			giblet_exploder_render_ground(&giblet_exploder, &screen);
+			PROF_END(&profiler, PROF_RENDER_GROUND);
+			PROF_BEGIN(&profiler, PROF_RENDER_ACTORS);
+			drummer_render(&drummer, &screen, &giblet_exploder);
+			player_render(&bass_player, &screen, song_end ? 0 : step, &giblet_exploder);
+			player_render(&guitar_player, &screen, song_end ? 0 : step, &giblet_exploder);
+			PROF_END(&profiler, PROF_RENDER_ACTORS);
+			PROF_BEGIN(&profiler, PROF_RENDER_PIANO_ROLL);
 			if (drummer.dead) {
-				screen_draw_rect(screen, 0, 0, SCREEN_WIDTH, 64, 0);
+				screen_draw_rect(&screen, 0, 0, SCREEN_WIDTH, 64, 0);
 			} else {
-				piano_roll_render(&piano_roll, screen, &font);
+				piano_roll_render(&piano_roll, &screen, &font);
+			}
+			PROF_END(&profiler, PROF_RENDER_PIANO_ROLL);
+
+			PROF_BEGIN(&profiler, PROF_RENDER_ZOMBIES);
+			zombie_director_render(&zombie_director, &screen, &giblet_exploder);
+			PROF_END(&profiler, PROF_RENDER_ZOMBIES);
+
+			if (profiler.overlay) profiler_render(&profiler, &screen, &font);
+
+			if (bench_render) {
+				for (int i = 0; i < BENCH_POOLS; i++) {
+					screen.pool = &bench_pools[i];
+					uint64_t t = SDL_GetPerformanceCounter();
+					screen_rasterize(&screen);
+					bench_ticks[i] += SDL_GetPerformanceCounter() - t;
+				}
+				screen.pool = &render_pool;
+				bench_frames++;
+			}
+		}
+		if (headless.enabled) {
+			uint64_t t = SDL_GetPerformanceCounter();
+			PROF_BEGIN(&profiler, PROF_RASTERIZE);
+			screen_end_frame(&screen);
+			PROF_END(&profiler, PROF_RASTERIZE);
+			headless.raster_ticks += SDL_GetPerformanceCounter() - t;
+			PROF_BEGIN(&profiler, PROF_PRESENT);
+			headless_present(&headless, &screen);
+			PROF_END(&profiler, PROF_PRESENT);
+			if (!menu) audio_pump(&audio, headless.fps);
+		} else if (cpu_upscale) {
+			PROF_BEGIN(&profiler, PROF_RASTERIZE);
+			screen_end_frame(&screen);
+			PROF_END(&profiler, PROF_RASTERIZE);
+			PROF_BEGIN(&profiler, PROF_PRESENT);
+			uint64_t t = SDL_GetPerformanceCounter();
+			if (!present_layout.valid) {
+				present_layout_update(&present_layout, renderer);
+				cpu_upscaler_fit(&cpu_upscaler, renderer, &present_layout, &screen);
 			}
+			SDL_Texture* upscaled = cpu_upscaler_upload(&cpu_upscaler, &screen, texture);
+			present_screen(renderer, upscaled, &present_layout);
+			present_ticks += SDL_GetPerformanceCounter() - t;
+			PROF_END(&profiler, PROF_PRESENT);
+		} else if (zero_copy) {
+			void* pixels;
+			int pitch;
+			SAZ(SDL_LockTexture(texture, NULL, &pixels, &pitch));
+			ASSERT((pitch % sizeof(uint32_t)) == 0);
+			screen_set_target(&screen, pixels, pitch / sizeof(uint32_t));
+			PROF_BEGIN(&profiler, PROF_RASTERIZE);
+			screen_end_frame(&screen);
+			PROF_END(&profiler, PROF_RASTERIZE);
+			PROF_BEGIN(&profiler, PROF_PRESENT);
+			uint64_t t = SDL_GetPerformanceCounter();
+			SDL_UnlockTexture(texture);
+			screen_reset_target(&screen);
+			present_screen(renderer, texture, &present_layout);
+			present_ticks += SDL_GetPerformanceCounter() - t;
+			PROF_END(&profiler, PROF_PRESENT);
+		} else {
+			PROF_BEGIN(&profiler, PROF_RASTERIZE);
+			screen_end_frame(&screen);
+			PROF_END(&profiler, PROF_RASTERIZE);
+			PROF_BEGIN(&profiler, PROF_PRESENT);
+			uint64_t t = SDL_GetPerformanceCounter();
+			SDL_UpdateTexture(texture, NULL, screen.pixels, screen.pitch * sizeof(uint32_t));
+			present_screen(renderer, texture, &present_layout);
+			present_ticks += SDL_GetPerformanceCounter() - t;
+			PROF_END(&profiler, PROF_PRESENT);
+		}
+
+		frame_ticks += SDL_GetPerformanceCounter() - t0;
+		n_frames++;
+		PROF_END(&profiler, PROF_FRAME);
+		profiler_end_frame(&profiler, screen.pixel_visits, giblet_exploder.n_giblets);
+	}
+
+	if (profile_csv != NULL) profiler_write_csv(&profiler, profile_csv);
+
+	if (replay.recording) replay_write(&replay, record_path);
+	if (replay.playing) {
+		printf("replay: %d of %d seconds checked match the recording\n",
+			replay.hashes_checked - replay.hash_failures,
+			replay.hashes_checked);
+	}
 
-			zombie_director_render(&zombie_director, screen, &giblet_exploder);
+	if (frame_times && n_frames > 0) {
+		double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+		printf("%d frames, %.3f ms/frame, of which present: %.3f ms/frame\n",
+			n_frames,
+			((double)frame_ticks * ms) / (double)n_frames,
+			((double)present_ticks * ms) / (double)n_frames);
+		printf("giblets: peak %d live of %d, %d overflowed (%s)\n",
+			giblet_exploder.peak_giblets,
+			giblet_exploder.max_giblets,
+			giblet_exploder.n_overflowed,
+			giblet_exploder.overflow == GIBLET_OVERFLOW_SPILL ? "spilled" : "dropped");
+	}
 
+	if (headless.enabled && headless.frame > 0) {
+		double freq = (double)SDL_GetPerformanceFrequency();
+		double seconds = (double)(SDL_GetPerformanceCounter() - headless.t0) / freq;
+		double raster_seconds = (double)headless.raster_ticks / freq;
+		printf("headless: %d frames in %.3fs, %.1f fps (rasterizer alone: %.1f fps)\n",
+			headless.frame,
+			seconds,
+			(double)headless.frame / seconds,
+			(double)headless.frame / raster_seconds);
+	}
 
-			//uint64_t frame_time = SDL_GetPerformanceCounter() - t0;
-			//printf("%lu\n", frame_time);
+	if (bench_render && bench_frames > 0) {
+		double freq = (double)SDL_GetPerformanceFrequency();
+		double base = 0;
+		printf("rasterizer, %dx%d, %d gameplay frames:\n", SCREEN_WIDTH * render_scale, SCREEN_HEIGHT * render_scale, bench_frames);
+		for (int i = 0; i < BENCH_POOLS; i++) {
+			double ms = ((double)bench_ticks[i] * 1000.0 / freq) / (double)bench_frames;
+			if (i == 0) base = ms;
+			printf("  %d thread(s): %.3f ms/frame (%.2fx)\n", bench_pool_threads[i], ms, base / ms);
 		}
-		present_screen(window, renderer, texture, screen);
 	}
+	if (bench_render) {
+		for (int i = 0; i < BENCH_POOLS; i++) render_pool_quit(&bench_pools[i]);
+	}
+	render_pool_quit(&render_pool);
 
 	audio_quit(&audio);
 
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+	if (trace_path != NULL) tracer_write(&tracer, trace_path);
+
+	if (!headless.enabled) {
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+	}
+
+	if (headless.golden_failures) {
+		fprintf(stderr, "%d frame(s) differ from golden images\n", headless.golden_failures);
+		return EXIT_FAILURE;
+	}
+
+	if (replay.hash_failures) return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
 }